@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""
+Minimal STUN over TCP responder (RFC 5389 framing) for trying --tcp-fallback
+locally. Every binding request gets a success response with XOR-MAPPED-ADDRESS
+of the peer. Responses to requests pipelined in one read are sent in reverse
+order and in small fragments, so reassembly and matching by transaction ID of
+StunTcpController are exercised too.
+
+Usage: tcp_stun_responder.py [--port 3478] [--mapped-address 198.51.100.7]
+  --mapped-address  report this address instead of the peer one, as a NAT would
+
+Block UDP to the port (or run no UDP server on it) and start
+  nat_type_detector --tcp-fallback 127.0.0.1 127.0.0.1
+The same server given twice gets both test 1 requests pipelined on one
+connection, the responder logs "2 requests in one read" and answers them in
+reverse order.
+"""
+
+import argparse
+import socket
+import struct
+import threading
+import time
+
+MAGIC_COOKIE = 0x2112A442
+HEADER_SIZE = 20
+BINDING_SUCCESS_RESPONSE = 0x0101
+XOR_MAPPED_ADDRESS = 0x0020
+FRAGMENT_SIZE = 7
+
+
+def make_response(request, peer, mapped_address):
+    transaction_id = request[8:20]
+    address = mapped_address if mapped_address else peer[0]
+    ip = struct.unpack('!I', socket.inet_aton(address))[0]
+    value = struct.pack('!HHI', 1, peer[1] ^ (MAGIC_COOKIE >> 16), ip ^ MAGIC_COOKIE)
+    attribute = struct.pack('!HH', XOR_MAPPED_ADDRESS, len(value)) + value
+
+    return struct.pack('!HHI', BINDING_SUCCESS_RESPONSE, len(attribute), MAGIC_COOKIE) + transaction_id + attribute
+
+
+def serve(connection, peer, mapped_address):
+    data = b''
+    while True:
+        chunk = connection.recv(4096)
+        if not chunk:
+            break
+        data += chunk
+
+        requests = []
+        while len(data) >= HEADER_SIZE:
+            size = HEADER_SIZE + struct.unpack('!H', data[2:4])[0]
+            if len(data) < size:
+                break
+            requests.append(data[:size])
+            data = data[size:]
+
+        print('%s:%d: %d requests in one read' % (peer[0], peer[1], len(requests)), flush=True)
+        responses = b''.join(make_response(request, peer, mapped_address) for request in reversed(requests))
+        for offset in range(0, len(responses), FRAGMENT_SIZE):
+            connection.sendall(responses[offset:offset + FRAGMENT_SIZE])
+            time.sleep(0.002)
+
+    connection.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Minimal STUN over TCP responder.')
+    parser.add_argument('--port', type=int, default=3478)
+    parser.add_argument('--mapped-address')
+    arguments = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('0.0.0.0', arguments.port))
+    server.listen(5)
+
+    while True:
+        connection, peer = server.accept()
+        threading.Thread(target=serve, args=(connection, peer, arguments.mapped_address), daemon=True).start()
+
+
+if __name__ == '__main__':
+    main()
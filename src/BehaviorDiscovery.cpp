@@ -0,0 +1,180 @@
+#include "BehaviorDiscovery.h"
+
+#include <iostream>
+#include <sstream>
+
+#include "Exception.h"
+#include "LocalAddressTable.h"
+
+
+using namespace std;
+
+
+BehaviorDiscovery::BehaviorDiscovery() :
+  mapping_controller_(make_unique<StunController>()),
+  filtering_address_controller_(make_unique<StunController>()),
+  filtering_port_controller_(make_unique<StunController>())
+{}
+
+void BehaviorDiscovery::execute(const string& server)
+{
+  server_ = server;
+
+  send_request(*mapping_controller_, server_, DEFAULT_PORT, 0,
+      [this](const StunMessage& response) { process_mapping_test_1(response); });
+
+  // Filtering tests use their own sockets, so packets of mapping tests don't open the NAT for them.
+  send_request(*filtering_address_controller_, server_, DEFAULT_PORT, change_ip_ | change_port_,
+      [this](const StunMessage& response) { filtering_response_2_ = response; });
+  send_request(*filtering_port_controller_, server_, DEFAULT_PORT, change_port_,
+      [this](const StunMessage& response) { filtering_response_3_ = response; });
+
+  loop_.run();
+
+  make_mapping_behavior();
+  make_filtering_behavior();
+}
+
+void BehaviorDiscovery::send_request(StunController& controller, const string& server, size_t port,
+    uint32_t change_request, StunTransactionLoop::ResponseHandler handler)
+{
+  StunMessage request(server, port, StunMessageType::BindingRequest);
+  if (0 != change_request)
+    request.add_int_attribute(StunAttributeType::ChangeAddress, change_request);
+
+  loop_.add_transaction(controller, request, move(handler), attempts_number_, rto_);
+}
+
+void BehaviorDiscovery::process_mapping_test_1(const StunMessage& response)
+{
+  if (StunMessageType::BindingSuccessResponse != response.get_type() ||
+      !response.get_mapped_address(mapped_address_1_, mapped_port_1_))
+  {
+    stringstream stream;
+    stream << "UDP is blocked or check access to " << server_ << " server";
+    throw Exception(stream.str());
+  }
+
+  primary_address_ = response.get_server();
+  primary_port_ = response.get_port();
+
+  auto attribute = response.get_attribute(StunAttributeType::OtherAddress);
+  if (nullptr == attribute)
+    attribute = response.get_attribute(StunAttributeType::ChangedAddress);
+
+  if (nullptr == attribute)
+    throw Exception("Server " + server_ + " doesn't support behavior discovery: OTHER-ADDRESS is missing");
+
+  StunMappedAddressAdapter other_address(attribute);
+  other_address_ = other_address.get_address();
+  other_port_ = other_address.get_port();
+
+  LocalAddressTable& local_addresses = LocalAddressTable::instance();
+  local_addresses.update();
+  is_nat_present_ = !local_addresses.contains(mapped_address_1_);
+  if (!is_nat_present_)
+    return;
+
+  // Test III is needed only if test II shows a new mapping, but it is cheaper
+  // to run it at once than to wait for test II.
+  send_request(*mapping_controller_, other_address_, primary_port_, 0,
+      [this](const StunMessage& response) { process_mapping_test_2(response); });
+  send_request(*mapping_controller_, other_address_, other_port_, 0,
+      [this](const StunMessage& response) { process_mapping_test_3(response); });
+  send_request(*mapping_controller_, mapped_address_1_, mapped_port_1_, 0,
+      [this](const StunMessage& response) { process_hairpinning_test(response); });
+}
+
+void BehaviorDiscovery::process_mapping_test_2(const StunMessage& response)
+{
+  if (StunMessageType::BindingSuccessResponse == response.get_type())
+    response.get_mapped_address(mapped_address_2_, mapped_port_2_);
+}
+
+void BehaviorDiscovery::process_mapping_test_3(const StunMessage& response)
+{
+  if (StunMessageType::BindingSuccessResponse == response.get_type())
+    response.get_mapped_address(mapped_address_3_, mapped_port_3_);
+}
+
+void BehaviorDiscovery::process_hairpinning_test(const StunMessage& response)
+{
+  is_hairpinning_supported_ = StunMessageType::BindingRequest == response.get_type();
+}
+
+void BehaviorDiscovery::make_mapping_behavior()
+{
+  if (!is_nat_present_)
+    mapping_behavior_ = Behavior::EndpointIndependent;
+  else if (mapped_address_2_.empty())
+    mapping_behavior_ = Behavior::Unknown;
+  else if (mapped_address_2_ == mapped_address_1_ && mapped_port_2_ == mapped_port_1_)
+    mapping_behavior_ = Behavior::EndpointIndependent;
+  else if (mapped_address_3_.empty())
+    mapping_behavior_ = Behavior::Unknown;
+  else if (mapped_address_3_ == mapped_address_2_ && mapped_port_3_ == mapped_port_2_)
+    mapping_behavior_ = Behavior::AddressDependent;
+  else
+    mapping_behavior_ = Behavior::AddressAndPortDependent;
+}
+
+void BehaviorDiscovery::make_filtering_behavior()
+{
+  bool is_response_2 = is_filtering_response(filtering_response_2_, true);
+  bool is_response_3 = is_filtering_response(filtering_response_3_, false);
+
+  if (!is_change_request_supported_)
+    filtering_behavior_ = Behavior::Unknown;
+  else if (is_response_2)
+    filtering_behavior_ = Behavior::EndpointIndependent;
+  else if (is_response_3)
+    filtering_behavior_ = Behavior::AddressDependent;
+  else
+    filtering_behavior_ = Behavior::AddressAndPortDependent;
+}
+
+bool BehaviorDiscovery::is_filtering_response(const StunMessage& response, bool is_address_changed)
+{
+  if (StunMessageType::Unknown == response.get_type())
+    return false;
+
+  bool is_changed = StunMessageType::BindingSuccessResponse == response.get_type() &&
+    response.get_port() != primary_port_ &&
+    (response.get_server() != primary_address_) == is_address_changed;
+
+  // Response from the same address says nothing about filtering, other results are still valid.
+  if (!is_changed)
+    is_change_request_supported_ = false;
+
+  return is_changed;
+}
+
+void BehaviorDiscovery::print_result() const
+{
+  cout << "NAT detected: " << (is_nat_present_ ? "YES" : "NO") << endl;
+  cout << "Mapping behavior: " << to_string(mapping_behavior_) << endl;
+  if (is_change_request_supported_)
+    cout << "Filtering behavior: " << to_string(filtering_behavior_) << endl;
+  else
+    cout << "Filtering behavior: unsupported by server (CHANGE-REQUEST is ignored)" << endl;
+  if (is_nat_present_)
+    cout << "Hairpinning: " << (is_hairpinning_supported_ ? "YES" : "NO") << endl;
+  cout << "Public IP: " << mapped_address_1_ << ":" << mapped_port_1_ << endl;
+}
+
+string BehaviorDiscovery::to_string(Behavior behavior)
+{
+  switch (behavior)
+  {
+    case Behavior::EndpointIndependent:
+      return "Endpoint-independent";
+    case Behavior::AddressDependent:
+      return "Address-dependent";
+    case Behavior::AddressAndPortDependent:
+      return "Address-and-port-dependent";
+    case Behavior::Unknown:
+      break;
+  }
+
+  return "Unknown";
+}
@@ -0,0 +1,87 @@
+#ifndef BEHAVIOR_DISCOVERY_H
+#define BEHAVIOR_DISCOVERY_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "StunController.h"
+#include "StunTransactionLoop.h"
+
+
+// NAT behavior discovery in accordance with RFC 5780: mapping and filtering
+// behavior and hairpinning. The server has to support OTHER-ADDRESS (or
+// CHANGED-ADDRESS), filtering is reported as unsupported by the server if it
+// ignores CHANGE-REQUEST. Tests which don't affect each other are
+// run concurrently from separate sockets:
+//  - mapping socket: test I, then tests II and III and the hairpinning test at once;
+//  - filtering sockets: test II (change IP and port) and test III (change port).
+class BehaviorDiscovery
+{
+public:
+  enum class Behavior
+  {
+    Unknown,
+    EndpointIndependent,
+    AddressDependent,
+    AddressAndPortDependent
+  };
+
+  BehaviorDiscovery();
+
+  void execute(const std::string& server);
+  void print_result() const;
+
+private:
+  void send_request(StunController& controller, const std::string& server, size_t port, uint32_t change_request,
+      StunTransactionLoop::ResponseHandler handler);
+
+  void process_mapping_test_1(const StunMessage& response);
+  void process_mapping_test_2(const StunMessage& response);
+  void process_mapping_test_3(const StunMessage& response);
+  void process_hairpinning_test(const StunMessage& response);
+
+  void make_mapping_behavior();
+  void make_filtering_behavior();
+  bool is_filtering_response(const StunMessage& response, bool is_address_changed);
+
+  static std::string to_string(Behavior behavior);
+
+private:
+  // Negative results take the whole budget, it matches the one second of the RFC 3489 detection.
+  static const size_t attempts_number_ = 2;
+  static const size_t rto_ = 333;
+
+  static const uint32_t change_ip_ = 0x04;
+  static const uint32_t change_port_ = 0x02;
+
+  std::string server_;
+  std::string primary_address_;
+  size_t primary_port_ = 0;
+  std::string other_address_;
+  size_t other_port_ = 0;
+
+  std::unique_ptr<StunController> mapping_controller_;
+  std::unique_ptr<StunController> filtering_address_controller_;
+  std::unique_ptr<StunController> filtering_port_controller_;
+  StunTransactionLoop loop_;
+
+  std::string mapped_address_1_;
+  size_t mapped_port_1_ = 0;
+  std::string mapped_address_2_;
+  size_t mapped_port_2_ = 0;
+  std::string mapped_address_3_;
+  size_t mapped_port_3_ = 0;
+
+  StunMessage filtering_response_2_;
+  StunMessage filtering_response_3_;
+
+  bool is_nat_present_ = false;
+  bool is_hairpinning_supported_ = false;
+  bool is_change_request_supported_ = true;
+
+  Behavior mapping_behavior_ = Behavior::Unknown;
+  Behavior filtering_behavior_ = Behavior::Unknown;
+};
+
+#endif /* end of include guard: BEHAVIOR_DISCOVERY_H */
@@ -0,0 +1,156 @@
+#include "BindingLifetimeProbe.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "Exception.h"
+
+
+using namespace std;
+
+
+BindingLifetimeProbe::BindingLifetimeProbe(size_t sockets_number, Duration min_lifetime, Duration max_lifetime,
+    Duration resolution) :
+  sockets_number_(max(sockets_number, size_t(2))), resolution_(resolution),
+  lower_bound_(min_lifetime), upper_bound_(max_lifetime)
+{}
+
+void BindingLifetimeProbe::execute(const string& server)
+{
+  server_ = server;
+  auto start_time = chrono::steady_clock::now();
+
+  // The first round covers both ends of the interval, later ones probe only inside it.
+  vector<Duration> idle_times;
+  for (size_t i = 0; i < sockets_number_; ++i)
+    idle_times.push_back(lower_bound_ + (upper_bound_ - lower_bound_) * i / (sockets_number_ - 1));
+
+  while (true)
+  {
+    run_round(idle_times);
+    ++rounds_number_;
+
+    cout << "Round " << rounds_number_ << ": mapping lives between " << lower_bound_.count() / 1000.0
+      << " and " << upper_bound_.count() / 1000.0 << " seconds" << endl;
+
+    if (!is_consistent_ || !is_lower_bound_confirmed_ || !is_upper_bound_confirmed_ ||
+        upper_bound_ - lower_bound_ <= resolution_)
+      break;
+
+    idle_times.clear();
+    for (size_t i = 1; i <= sockets_number_; ++i)
+      idle_times.push_back(lower_bound_ + (upper_bound_ - lower_bound_) * i / (sockets_number_ + 1));
+  }
+
+  elapsed_time_ = chrono::steady_clock::now() - start_time;
+}
+
+void BindingLifetimeProbe::run_round(const vector<Duration>& idle_times)
+{
+  probes_.clear();
+  probes_.reserve(idle_times.size());
+  for (auto idle_time : idle_times)
+    probes_.push_back(Probe { make_unique<StunController>(), idle_time, string(), 0, ProbeState::Pending });
+  control_controller_ = make_unique<StunController>();
+
+  for (auto& probe : probes_)
+    send_request(probe, [this, &probe](const StunMessage& response) { process_first_response(probe, response); });
+
+  loop_.run();
+
+  // A server which ignores RESPONSE-PORT answers the control socket, every mapping would look expired.
+  StunMessage message;
+  if (control_controller_->read_message(message))
+    throw Exception("Server " + server_ + " doesn't support RESPONSE-PORT (RFC 5780)");
+
+  Duration longest_alive = Duration::min();
+  Duration shortest_expired = Duration::max();
+  size_t lost_number = 0;
+  for (auto& probe : probes_)
+  {
+    if (ProbeState::Alive == probe.state)
+      longest_alive = max(longest_alive, probe.idle_time);
+    else if (ProbeState::Expired == probe.state)
+      shortest_expired = min(shortest_expired, probe.idle_time);
+    else
+      ++lost_number;
+  }
+
+  if (lost_number == probes_.size())
+    throw Exception("UDP is blocked or check access to " + server_ + " server");
+
+  if (Duration::min() != longest_alive)
+  {
+    lower_bound_ = max(lower_bound_, longest_alive);
+    is_lower_bound_confirmed_ = true;
+  }
+
+  if (Duration::max() != shortest_expired)
+  {
+    upper_bound_ = min(upper_bound_, shortest_expired);
+    is_upper_bound_confirmed_ = true;
+  }
+
+  // A mapping expired earlier than another one survived: NAT doesn't have a
+  // single idle timeout or it reuses ports, so narrowing can't continue.
+  if (Duration::min() != longest_alive && Duration::max() != shortest_expired && shortest_expired < longest_alive)
+    is_consistent_ = false;
+}
+
+void BindingLifetimeProbe::send_request(Probe& probe, StunTransactionLoop::ResponseHandler handler)
+{
+  StunMessage request(server_, DEFAULT_PORT, StunMessageType::BindingRequest);
+  loop_.add_transaction(*probe.controller, request, move(handler), attempts_number_, rto_);
+}
+
+void BindingLifetimeProbe::process_first_response(Probe& probe, const StunMessage& response)
+{
+  if (StunMessageType::BindingSuccessResponse != response.get_type() ||
+      !response.get_mapped_address(probe.address, probe.port))
+  {
+    probe.state = ProbeState::Lost;
+    return;
+  }
+
+  loop_.add_timer(probe.idle_time, [this, &probe]()
+      {
+        StunMessage request(server_, DEFAULT_PORT, StunMessageType::BindingRequest);
+        request.add_int_attribute(StunAttributeType::ResponsePort, uint32_t(probe.port) << 16);
+        loop_.add_transaction(*probe.controller, request,
+            [this, &probe](const StunMessage& response) { process_second_response(probe, response); },
+            attempts_number_, rto_, control_controller_.get());
+      });
+}
+
+void BindingLifetimeProbe::process_second_response(Probe& probe, const StunMessage& response)
+{
+  // Response is sent to the mapped port of the probed socket, it arrives only through the original mapping.
+  probe.state = StunMessageType::BindingSuccessResponse == response.get_type() ?
+    ProbeState::Alive : ProbeState::Expired;
+}
+
+void BindingLifetimeProbe::print_result() const
+{
+  auto flags = cout.flags();
+  auto precision = cout.precision();
+  cout << fixed << setprecision(3);
+
+  if (!is_consistent_)
+    cout << "Binding lifetime: inconsistent, mappings expired after " << upper_bound_.count() / 1000.0
+      << " seconds while others survived " << lower_bound_.count() / 1000.0 << " seconds" << endl;
+  else if (!is_upper_bound_confirmed_)
+    cout << "Binding lifetime: longer than " << lower_bound_.count() / 1000.0 << " seconds" << endl;
+  else if (!is_lower_bound_confirmed_)
+    cout << "Binding lifetime: shorter than " << upper_bound_.count() / 1000.0 << " seconds" << endl;
+  else
+    cout << "Binding lifetime: " << (lower_bound_ + upper_bound_).count() / 2000.0 << " seconds, "
+      << "between " << lower_bound_.count() / 1000.0 << " and " << upper_bound_.count() / 1000.0 << " seconds"
+      << endl;
+
+  cout << "Rounds: " << rounds_number_ << ", elapsed: "
+    << chrono::duration_cast<chrono::milliseconds>(elapsed_time_).count() / 1000.0 << " seconds" << endl;
+
+  cout.flags(flags);
+  cout.precision(precision);
+}
@@ -0,0 +1,80 @@
+#ifndef BINDING_LIFETIME_PROBE_H
+#define BINDING_LIFETIME_PROBE_H
+
+#include <cstddef>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "StunController.h"
+#include "StunTransactionLoop.h"
+
+
+// Finds how long NAT keeps an idle UDP mapping. Every round opens many sockets,
+// creates a mapping from each of them and lets the mappings idle for durations
+// staggered across the searched interval, then probes them as RFC 5780 4.6
+// does: a request with RESPONSE-PORT set to the mapped port is sent from
+// another socket, so the probe itself doesn't refresh or re-create the mapping,
+// and the mapping is alive if the response arrives on the probed socket. The
+// interval is narrowed to the longest alive and the shortest expired idle time
+// and the next round is run inside it until the requested resolution is reached.
+// The server must support RESPONSE-PORT.
+class BindingLifetimeProbe
+{
+public:
+  using Duration = std::chrono::milliseconds;
+
+  BindingLifetimeProbe(size_t sockets_number, Duration min_lifetime, Duration max_lifetime, Duration resolution);
+
+  void execute(const std::string& server);
+  void print_result() const;
+
+private:
+  enum class ProbeState
+  {
+    Pending,
+    Alive,
+    Expired,
+    Lost
+  };
+
+  struct Probe
+  {
+    std::unique_ptr<StunController> controller;
+    Duration idle_time;
+    std::string address;
+    size_t port;
+    ProbeState state;
+  };
+
+  void run_round(const std::vector<Duration>& idle_times);
+
+  void send_request(Probe& probe, StunTransactionLoop::ResponseHandler handler);
+  void process_first_response(Probe& probe, const StunMessage& response);
+  void process_second_response(Probe& probe, const StunMessage& response);
+
+private:
+  static const size_t attempts_number_ = 3;
+  static const size_t rto_ = 500;
+
+  size_t sockets_number_;
+  Duration resolution_;
+
+  std::string server_;
+  StunTransactionLoop loop_;
+  // Sends the second requests of a round.
+  std::unique_ptr<StunController> control_controller_;
+  std::vector<Probe> probes_;
+
+  // Mapping survived lower_bound_ and didn't survive upper_bound_.
+  Duration lower_bound_;
+  Duration upper_bound_;
+  bool is_lower_bound_confirmed_ = false;
+  bool is_upper_bound_confirmed_ = false;
+  bool is_consistent_ = true;
+  size_t rounds_number_ = 0;
+  std::chrono::steady_clock::duration elapsed_time_;
+};
+
+#endif /* end of include guard: BINDING_LIFETIME_PROBE_H */
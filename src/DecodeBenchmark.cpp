@@ -0,0 +1,134 @@
+#include "DecodeBenchmark.h"
+
+#include <netinet/in.h>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "StunMessage.h"
+#include "StunMessageArena.h"
+
+
+using namespace std;
+
+
+namespace
+{
+
+string make_address_value(uint16_t port, uint32_t address)
+{
+  string value(2 * sizeof(uint16_t) + sizeof(uint32_t), '\0');
+  uint16_t family = htons(AddressFamily::IPv4);
+  port = htons(port);
+  address = htonl(address);
+  memcpy(&value[0], &family, sizeof(family));
+  memcpy(&value[sizeof(uint16_t)], &port, sizeof(port));
+  memcpy(&value[2 * sizeof(uint16_t)], &address, sizeof(address));
+
+  return value;
+}
+
+}
+
+
+DecodeBenchmark::DecodeBenchmark(size_t packets_number, size_t batch_size) :
+  packets_number_(packets_number), batch_size_(batch_size)
+{
+}
+
+void DecodeBenchmark::add_packet(const vector<byte>& packet)
+{
+  packets_.push_back(packet);
+}
+
+void DecodeBenchmark::execute()
+{
+  if (packets_.empty())
+    packets_.push_back(make_response());
+
+  heap_result_ = measure_heap();
+  arena_result_ = measure_arena();
+}
+
+void DecodeBenchmark::print_result() const
+{
+  cout << "Decoded packets: " << packets_number_ << " (" << packets_.size() << " distinct)" << endl;
+  print_result("Heap", heap_result_);
+  print_result("Arena", arena_result_);
+}
+
+DecodeBenchmark::Result DecodeBenchmark::measure_heap() const
+{
+  CountingMemoryResource memory;
+  string address;
+  size_t port;
+
+  // Messages are reused per batch as in the arena loop, so the memory resource is the only difference.
+  auto begin = chrono::steady_clock::now();
+  for (size_t i = 0; i < packets_number_; i += batch_size_)
+  {
+    StunMessage message((StunMessage::allocator_type(&memory)));
+    for (size_t j = i; j < i + batch_size_ && j < packets_number_; ++j)
+    {
+      auto& packet = packets_[j % packets_.size()];
+      message.set_data(packet.data(), packet.size());
+      message.get_mapped_address(address, port);
+    }
+  }
+  chrono::duration<double, nano> duration = chrono::steady_clock::now() - begin;
+
+  return Result { duration.count() / packets_number_, double(memory.get_allocations_number()) / packets_number_,
+    double(memory.get_allocated_bytes()) / packets_number_ };
+}
+
+DecodeBenchmark::Result DecodeBenchmark::measure_arena() const
+{
+  CountingMemoryResource memory;
+  StunMessageArena arena(&memory);
+  string address;
+  size_t port;
+
+  auto begin = chrono::steady_clock::now();
+  for (size_t i = 0; i < packets_number_; i += batch_size_)
+  {
+    {
+      StunMessage message((StunMessage::allocator_type(arena.get_resource())));
+      for (size_t j = i; j < i + batch_size_ && j < packets_number_; ++j)
+      {
+        auto& packet = packets_[j % packets_.size()];
+        message.set_data(packet.data(), packet.size());
+        message.get_mapped_address(address, port);
+      }
+    }
+
+    arena.reset();
+  }
+  chrono::duration<double, nano> duration = chrono::steady_clock::now() - begin;
+
+  return Result { duration.count() / packets_number_, double(memory.get_allocations_number()) / packets_number_,
+    double(memory.get_allocated_bytes()) / packets_number_ };
+}
+
+vector<byte> DecodeBenchmark::make_response()
+{
+  StunMessage message("127.0.0.1", DEFAULT_PORT, StunMessageType::BindingSuccessResponse);
+  message.add_string_attribute(StunAttributeType::MappedAddress, make_address_value(54321, 0xC6336401));
+  message.add_string_attribute(StunAttributeType::XorMappedAddress1,
+      make_address_value(54321 ^ (MAGIC_COOKIE >> 16), 0xC6336401 ^ MAGIC_COOKIE));
+  message.add_string_attribute(StunAttributeType::ResponseOrigin, make_address_value(3478, 0xCB007101));
+  message.add_string_attribute(StunAttributeType::OtherAddress, make_address_value(3479, 0xCB007102));
+  message.add_string_attribute(StunAttributeType::Software, "nat_type_detector");
+  message.add_int_attribute(StunAttributeType::Fingerprint, 0);
+
+  return message.get_data();
+}
+
+void DecodeBenchmark::print_result(const char* name, const Result& result)
+{
+  cout << setw(7) << left << (string(name) + ":") << right << fixed << setprecision(1)
+    << setw(8) << result.nanoseconds_per_packet << " ns/packet, "
+    << setprecision(3) << setw(7) << result.allocations_per_packet << " allocations/packet, "
+    << setprecision(1) << setw(7) << result.bytes_per_packet << " bytes/packet" << endl;
+}
@@ -0,0 +1,45 @@
+#ifndef DECODE_BENCHMARK_H
+#define DECODE_BENCHMARK_H
+
+#include <cstddef>
+#include <vector>
+
+
+// Measures decoding of received datagrams into attributes allocated on the heap
+// and in the per-batch arena used by the transaction loop. Both loops reuse one
+// message per batch, so only the memory resource differs. Packets are a
+// typical binding response unless a corpus is added.
+class DecodeBenchmark
+{
+public:
+  explicit DecodeBenchmark(size_t packets_number, size_t batch_size = 64);
+
+  void add_packet(const std::vector<std::byte>& packet);
+
+  void execute();
+  void print_result() const;
+
+private:
+  struct Result
+  {
+    double nanoseconds_per_packet;
+    double allocations_per_packet;
+    double bytes_per_packet;
+  };
+
+  Result measure_heap() const;
+  Result measure_arena() const;
+
+  static std::vector<std::byte> make_response();
+  static void print_result(const char* name, const Result& result);
+
+private:
+  size_t packets_number_;
+  size_t batch_size_;
+
+  std::vector<std::vector<std::byte>> packets_;
+  Result heap_result_;
+  Result arena_result_;
+};
+
+#endif /* end of include guard: DECODE_BENCHMARK_H */
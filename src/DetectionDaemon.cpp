@@ -0,0 +1,371 @@
+#include "DetectionDaemon.h"
+
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "DetectionSnapshot.h"
+#include "Exception.h"
+#include "LocalAddressTable.h"
+
+
+using namespace std;
+
+
+namespace
+{
+
+volatile sig_atomic_t is_stopped = 0;
+
+void stop_handler(int)
+{
+  is_stopped = 1;
+}
+
+sockaddr_un make_socket_address(const string& socket_path)
+{
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+
+  if (socket_path.size() >= sizeof(address.sun_path))
+    throw Exception("Socket path is too long: " + socket_path);
+
+  memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+  return address;
+}
+
+int connect_to_daemon(const string& socket_path)
+{
+  auto address = make_socket_address(socket_path);
+
+  int client = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (-1 == client)
+    throw Exception("Failed to create socket.");
+
+  if (-1 == connect(client, (struct sockaddr *) &address, sizeof(address)))
+  {
+    close(client);
+    stringstream stream;
+    stream << "Failed to connect to daemon at " << socket_path << ". Error: " << strerror(errno);
+    throw Exception(stream.str());
+  }
+
+  return client;
+}
+
+}
+
+
+DetectionDaemon::DetectionDaemon(const string& socket_path, size_t refresh_interval) :
+  socket_path_(socket_path), refresh_interval_(refresh_interval)
+{
+  auto address = make_socket_address(socket_path_);
+
+  listen_socket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (-1 == listen_socket_)
+    throw Exception("Failed to create socket.");
+
+  unlink(socket_path_.c_str());
+  if (-1 == bind(listen_socket_, (struct sockaddr *) &address, sizeof(address)) ||
+      -1 == listen(listen_socket_, SOMAXCONN))
+  {
+    stringstream stream;
+    stream << "Failed to listen on " << socket_path_ << ". Error: " << strerror(errno);
+    close(listen_socket_);
+    throw Exception(stream.str());
+  }
+
+  // Destructor isn't called if the constructor throws, so the bound socket is released here.
+  try
+  {
+    result_event_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stop_event_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == result_event_ || -1 == stop_event_)
+      throw Exception("Failed to create event descriptor.");
+
+    snapshot_ = make_unique<DetectionSnapshot>(DetectionSnapshot::make_name(socket_path_), true);
+  }
+  catch (...)
+  {
+    if (result_event_ != -1)
+      close(result_event_);
+    if (stop_event_ != -1)
+      close(stop_event_);
+    close(listen_socket_);
+    unlink(socket_path_.c_str());
+    throw;
+  }
+}
+
+DetectionDaemon::~DetectionDaemon()
+{
+  for (auto client : clients_)
+    close(client);
+
+  close(listen_socket_);
+  unlink(socket_path_.c_str());
+
+  if (result_event_ != -1)
+    close(result_event_);
+  if (stop_event_ != -1)
+    close(stop_event_);
+}
+
+void DetectionDaemon::execute(const string& server1, const string& server2)
+{
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop_handler;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  // Signals are delivered to the serving loop only, the detection thread is stopped by stop_event_.
+  // They stay blocked except inside ppoll, so a signal arriving after the check of is_stopped
+  // interrupts the next wait instead of being lost.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigset_t previous_signals;
+  pthread_sigmask(SIG_BLOCK, &signals, &previous_signals);
+  thread detection_thread(&DetectionDaemon::detect, this, server1, server2);
+
+  sigset_t wait_signals = previous_signals;
+  sigdelset(&wait_signals, SIGINT);
+  sigdelset(&wait_signals, SIGTERM);
+
+  while (!is_stopped)
+  {
+    vector<pollfd> descriptors = { { listen_socket_, POLLIN, 0 }, { result_event_, POLLIN, 0 } };
+    for (auto client : clients_)
+      descriptors.push_back(pollfd { client, POLLIN, 0 });
+
+    if (-1 == ppoll(descriptors.data(), descriptors.size(), nullptr, &wait_signals))
+    {
+      if (EINTR == errno)
+        continue;
+
+      break;
+    }
+
+    // Clients aren't expected to send anything, so readability means disconnection.
+    for (size_t i = 2; i < descriptors.size(); ++i)
+    {
+      if (0 == descriptors[i].revents)
+        continue;
+
+      char buffer[256];
+      if (recv(descriptors[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+        continue;
+
+      close(descriptors[i].fd);
+      clients_.erase(remove(begin(clients_), end(clients_), descriptors[i].fd), end(clients_));
+    }
+
+    if (0 != (descriptors[1].revents & POLLIN))
+    {
+      uint64_t value;
+      read(result_event_, &value, sizeof(value));
+
+      string line;
+      {
+        lock_guard<mutex> lock(mutex_);
+        line = serialize_result(result_) + '\n';
+      }
+
+      auto current_clients = clients_;
+      for (auto client : current_clients)
+        send_result(client, line);
+    }
+
+    if (0 != (descriptors[0].revents & POLLIN))
+      accept_client();
+  }
+
+  uint64_t value = 1;
+  write(stop_event_, &value, sizeof(value));
+  detection_thread.join();
+
+  pthread_sigmask(SIG_SETMASK, &previous_signals, nullptr);
+}
+
+void DetectionDaemon::detect(const string& server1, const string& server2)
+{
+  while (!is_stopped)
+  {
+    try
+    {
+      NatTypeDetector detector;
+      detector.execute(server1, server2);
+      publish(detector.get_result());
+    }
+    catch (const Exception& exception)
+    {
+      cerr << exception.what() << endl;
+    }
+
+    wait_for_refresh();
+  }
+}
+
+void DetectionDaemon::wait_for_refresh()
+{
+  LocalAddressTable& local_addresses = LocalAddressTable::instance();
+  uint64_t generation = local_addresses.get_generation();
+
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(refresh_interval_);
+  while (!is_stopped)
+  {
+    // Detection has already seen changes counted by generation, newer ones trigger it again.
+    local_addresses.update();
+    if (local_addresses.get_generation() != generation)
+      return;
+
+    auto now = chrono::steady_clock::now();
+    if (now >= deadline)
+      return;
+
+    vector<pollfd> descriptors = { { stop_event_, POLLIN, 0 } };
+    if (-1 != local_addresses.get_socket())
+      descriptors.push_back(pollfd { local_addresses.get_socket(), POLLIN, 0 });
+
+    int timeout = chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1;
+    if (poll(descriptors.data(), descriptors.size(), timeout) > 0 && 0 != descriptors[0].revents)
+      return;
+  }
+}
+
+void DetectionDaemon::publish(const NatDetectionResult& result)
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+
+    bool is_changed = !is_result_ready_ ||
+      result.is_nat_present != result_.is_nat_present ||
+      result.is_firewall_present != result_.is_firewall_present ||
+      result.nat_type != result_.nat_type ||
+      result.public_ip != result_.public_ip;
+
+    // Snapshot always carries the time of the latest confirmation.
+    result_ = result;
+    is_result_ready_ = true;
+    snapshot_->publish(result_, refresh_interval_);
+
+    if (!is_changed)
+      return;
+  }
+
+  uint64_t value = 1;
+  write(result_event_, &value, sizeof(value));
+}
+
+void DetectionDaemon::accept_client()
+{
+  int client;
+  while (-1 != (client = accept4(listen_socket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)))
+  {
+    clients_.push_back(client);
+
+    string line;
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (is_result_ready_)
+        line = serialize_result(result_) + '\n';
+    }
+
+    if (!line.empty())
+      send_result(client, line);
+  }
+}
+
+void DetectionDaemon::send_result(int client, const string& line)
+{
+  // A line is tiny, a client which can't take it at once is dropped.
+  if (static_cast<ssize_t>(line.size()) == send(client, line.data(), line.size(), MSG_NOSIGNAL))
+    return;
+
+  close(client);
+  clients_.erase(remove(begin(clients_), end(clients_), client), end(clients_));
+}
+
+bool DetectionDaemon::query(const string& socket_path, NatDetectionResult& result)
+{
+  try
+  {
+    DetectionSnapshot snapshot(DetectionSnapshot::make_name(socket_path), false);
+    if (snapshot.read(result))
+      return true;
+  }
+  catch (const Exception&)
+  {
+    // Snapshot isn't accessible, the daemon is asked directly.
+  }
+
+  int client = connect_to_daemon(socket_path);
+
+  // Daemon sends its result at once after accepting, nothing comes while it has none yet.
+  timeval timeout { query_timeout_ / 1000, query_timeout_ % 1000 * 1000 };
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  string line;
+  char symbol;
+  while (1 == recv(client, &symbol, 1, 0) && '\n' != symbol)
+    line += symbol;
+
+  close(client);
+
+  return parse_result(line, result);
+}
+
+void DetectionDaemon::watch(const string& socket_path)
+{
+  int client = connect_to_daemon(socket_path);
+
+  string line;
+  char buffer[1024];
+  ssize_t size;
+  while ((size = recv(client, buffer, sizeof(buffer), 0)) > 0)
+  {
+    line.append(buffer, size);
+
+    size_t position;
+    while (string::npos != (position = line.find('\n')))
+    {
+      NatDetectionResult result;
+      if (parse_result(line.substr(0, position), result))
+      {
+        cout << "Result at: " << put_time(localtime(&result.timestamp), "%F %T") << endl;
+        print_result(result);
+        cout << endl;
+      }
+
+      line.erase(0, position + 1);
+    }
+  }
+
+  close(client);
+}
+
+string DetectionDaemon::get_default_socket_path()
+{
+  if (const char* runtime_directory = getenv("XDG_RUNTIME_DIR");
+      nullptr != runtime_directory && '\0' != runtime_directory[0])
+    return string(runtime_directory) + "/nat_type_detector.sock";
+
+  return "/tmp/nat_type_detector." + to_string(getuid()) + ".sock";
+}
@@ -0,0 +1,71 @@
+#ifndef DETECTION_DAEMON_H
+#define DETECTION_DAEMON_H
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "NatTypeDetector.h"
+
+
+class DetectionSnapshot;
+
+
+// Runs detection in the background and serves its result to local processes.
+// The result is published in a shared memory snapshot for readers which don't
+// want any I/O, and over a Unix domain socket: a connected client receives the
+// current result at once and a new line every time the result changes.
+// Detection is repeated every refresh interval and when local addresses change.
+class DetectionDaemon
+{
+public:
+  DetectionDaemon(const std::string& socket_path, size_t refresh_interval);
+  DetectionDaemon(const DetectionDaemon& daemon) = delete;
+  DetectionDaemon& operator=(const DetectionDaemon& daemon) = delete;
+  ~DetectionDaemon();
+
+  // Serves until SIGINT or SIGTERM.
+  void execute(const std::string& server1, const std::string& server2);
+
+  // Client side: reads the snapshot published by the daemon listening on socket_path.
+  static bool query(const std::string& socket_path, NatDetectionResult& result);
+  // Client side: prints every result pushed by the daemon until it disconnects.
+  static void watch(const std::string& socket_path);
+
+  static std::string get_default_socket_path();
+
+private:
+  void detect(const std::string& server1, const std::string& server2);
+  void wait_for_refresh();
+
+  void publish(const NatDetectionResult& result);
+
+  void accept_client();
+  void send_result(int client, const std::string& line);
+
+private:
+  // Milliseconds query() waits for the daemon to send its result.
+  static const long query_timeout_ = 1000;
+
+  std::string socket_path_;
+  size_t refresh_interval_;
+
+  int listen_socket_ = -1;
+  // Wakes up the serving loop when a new result is published.
+  int result_event_ = -1;
+  // Interrupts waiting of the detection thread on shutdown.
+  int stop_event_ = -1;
+
+  std::unique_ptr<DetectionSnapshot> snapshot_;
+
+  std::mutex mutex_;
+  bool is_result_ready_ = false;
+  NatDetectionResult result_;
+
+  std::vector<int> clients_;
+};
+
+#endif /* end of include guard: DETECTION_DAEMON_H */
@@ -0,0 +1,142 @@
+#include "DetectionSnapshot.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <functional>
+#include <sstream>
+
+#include "Exception.h"
+
+
+using namespace std;
+
+
+struct DetectionSnapshotPayload
+{
+  uint8_t is_nat_present;
+  uint8_t is_firewall_present;
+  int64_t timestamp;
+  // Lets readers tell a snapshot left behind by a killed daemon.
+  int32_t pid;
+  uint32_t refresh_interval;
+  char nat_type[64];
+  char public_ip[INET6_ADDRSTRLEN];
+};
+
+struct DetectionSnapshotData
+{
+  // Odd while the writer updates the payload, 0 until the first publication.
+  std::atomic<uint32_t> sequence;
+  DetectionSnapshotPayload payload;
+};
+
+
+DetectionSnapshot::DetectionSnapshot(const string& name, bool is_writer) : name_(name), is_writer_(is_writer)
+{
+  int descriptor = shm_open(name_.c_str(), is_writer_ ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+  if (-1 == descriptor)
+  {
+    stringstream stream;
+    stream << "Failed to open shared memory " << name_ << ". Error: " << strerror(errno);
+    throw Exception(stream.str());
+  }
+
+  if (is_writer_ && -1 == ftruncate(descriptor, sizeof(DetectionSnapshotData)))
+  {
+    close(descriptor);
+    throw Exception("Failed to resize shared memory " + name_);
+  }
+
+  void* data = mmap(nullptr, sizeof(DetectionSnapshotData), is_writer_ ? PROT_READ | PROT_WRITE : PROT_READ,
+      MAP_SHARED, descriptor, 0);
+  close(descriptor);
+
+  if (MAP_FAILED == data)
+    throw Exception("Failed to map shared memory " + name_);
+
+  data_ = static_cast<DetectionSnapshotData*>(data);
+  if (is_writer_)
+    data_->sequence.store(0, memory_order_relaxed);
+}
+
+DetectionSnapshot::~DetectionSnapshot()
+{
+  munmap(data_, sizeof(DetectionSnapshotData));
+
+  if (is_writer_)
+    shm_unlink(name_.c_str());
+}
+
+void DetectionSnapshot::publish(const NatDetectionResult& result, size_t refresh_interval)
+{
+  DetectionSnapshotPayload payload;
+  memset(&payload, 0, sizeof(payload));
+  payload.is_nat_present = result.is_nat_present;
+  payload.is_firewall_present = result.is_firewall_present;
+  payload.timestamp = result.timestamp;
+  payload.pid = getpid();
+  payload.refresh_interval = refresh_interval;
+  strncpy(payload.nat_type, result.nat_type.c_str(), sizeof(payload.nat_type) - 1);
+  strncpy(payload.public_ip, result.public_ip.c_str(), sizeof(payload.public_ip) - 1);
+
+  uint32_t sequence = data_->sequence.load(memory_order_relaxed);
+  data_->sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(&data_->payload, &payload, sizeof(payload));
+  data_->sequence.store(sequence + 2, memory_order_release);
+}
+
+bool DetectionSnapshot::read(NatDetectionResult& result) const
+{
+  DetectionSnapshotPayload payload;
+  uint32_t sequence;
+
+  // A writer which died in the middle of publishing leaves the sequence odd forever.
+  size_t attempts_left = read_attempts_number_;
+  while (true)
+  {
+    if (0 == attempts_left--)
+      return false;
+
+    sequence = data_->sequence.load(memory_order_acquire);
+    if (0 != sequence % 2)
+      continue;
+
+    memcpy(&payload, &data_->payload, sizeof(payload));
+    atomic_thread_fence(memory_order_acquire);
+
+    if (data_->sequence.load(memory_order_relaxed) == sequence)
+      break;
+  }
+
+  if (0 == sequence)
+    return false;
+
+  // Daemon is gone or has missed refreshes, the result may be outdated.
+  if ((-1 == kill(payload.pid, 0) && ESRCH == errno) ||
+      time(nullptr) - payload.timestamp > 2 * int64_t(payload.refresh_interval))
+    return false;
+
+  result.is_nat_present = payload.is_nat_present;
+  result.is_firewall_present = payload.is_firewall_present;
+  result.timestamp = payload.timestamp;
+  result.nat_type = string(payload.nat_type, strnlen(payload.nat_type, sizeof(payload.nat_type)));
+  result.public_ip = string(payload.public_ip, strnlen(payload.public_ip, sizeof(payload.public_ip)));
+
+  return true;
+}
+
+string DetectionSnapshot::make_name(const string& socket_path)
+{
+  stringstream stream;
+  stream << "/nat_type_detector." << hex << hash<string>()(socket_path);
+
+  return stream.str();
+}
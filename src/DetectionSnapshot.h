@@ -0,0 +1,41 @@
+#ifndef DETECTION_SNAPSHOT_H
+#define DETECTION_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "NatTypeDetector.h"
+
+
+struct DetectionSnapshotData;
+
+// Detection result published in POSIX shared memory and guarded by a seqlock:
+// one writer (the daemon) and any number of lock-free readers in other processes.
+class DetectionSnapshot
+{
+public:
+  DetectionSnapshot(const std::string& name, bool is_writer);
+  DetectionSnapshot(const DetectionSnapshot& snapshot) = delete;
+  DetectionSnapshot& operator=(const DetectionSnapshot& snapshot) = delete;
+  ~DetectionSnapshot();
+
+  // Refresh interval of the writer bounds the age of a fresh result.
+  void publish(const NatDetectionResult& result, size_t refresh_interval);
+  // Returns false if no result has been published yet or the snapshot is
+  // stale: it stays locked by a writer after a bounded number of attempts,
+  // the writer process is gone or the result is older than two refresh
+  // intervals.
+  bool read(NatDetectionResult& result) const;
+
+  static std::string make_name(const std::string& socket_path);
+
+private:
+  static constexpr size_t read_attempts_number_ = 100000;
+
+  std::string name_;
+  bool is_writer_;
+  DetectionSnapshotData* data_ = nullptr;
+};
+
+#endif /* end of include guard: DETECTION_SNAPSHOT_H */
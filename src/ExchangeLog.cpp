@@ -0,0 +1,230 @@
+#include "ExchangeLog.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+
+#include "Exception.h"
+#include "LocalAddressTable.h"
+
+
+using namespace std;
+
+
+namespace
+{
+
+const char magic[8] = { 'N', 'A', 'T', 'X', 'L', 'O', 'G', '1' };
+
+size_t get_padded_size(size_t size)
+{
+  return (size + 7) / 8 * 8;
+}
+
+}
+
+
+/***************************** ExchangeRecorder *******************************/
+
+ExchangeRecorder::~ExchangeRecorder()
+{
+  close();
+}
+
+ExchangeRecorder& ExchangeRecorder::instance()
+{
+  static ExchangeRecorder recorder;
+
+  return recorder;
+}
+
+void ExchangeRecorder::open(const string& path)
+{
+  lock_guard<mutex> lock(mutex_);
+
+  if (is_open_)
+    throw Exception("Exchange log is already open.");
+
+  file_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (-1 == file_)
+  {
+    stringstream stream;
+    stream << "Failed to open exchange log " << path << ". Error: " << strerror(errno);
+    throw Exception(stream.str());
+  }
+
+  reserve(sizeof(magic));
+  memcpy(memory_, magic, sizeof(magic));
+  size_ = sizeof(magic);
+
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  LocalAddressTable& local_addresses = LocalAddressTable::instance();
+  local_addresses.update();
+  for (auto& address : local_addresses.get_addresses())
+  {
+    ExchangeRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.timestamp = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+    header.size = address.size();
+    header.direction = static_cast<uint8_t>(ExchangeDirection::LocalAddress);
+    write_record(header, address.data());
+  }
+
+  is_open_ = true;
+}
+
+void ExchangeRecorder::close()
+{
+  lock_guard<mutex> lock(mutex_);
+
+  if (nullptr != memory_)
+    munmap(memory_, capacity_);
+
+  if (-1 != file_)
+  {
+    ftruncate(file_, size_);
+    ::close(file_);
+  }
+
+  is_open_ = false;
+  file_ = -1;
+  memory_ = nullptr;
+  capacity_ = 0;
+  size_ = 0;
+}
+
+bool ExchangeRecorder::is_open() const
+{
+  return is_open_;
+}
+
+void ExchangeRecorder::record(ExchangeDirection direction, ExchangeTransport transport, size_t local_port,
+    const sockaddr_in& peer, const void* data, size_t size, const timespec* time)
+{
+  ExchangeRecordHeader header;
+  memset(&header, 0, sizeof(header));
+
+  timespec now;
+  if (nullptr == time)
+  {
+    clock_gettime(CLOCK_REALTIME, &now);
+    time = &now;
+  }
+  header.timestamp = uint64_t(time->tv_sec) * 1000000000 + time->tv_nsec;
+
+  header.local_port = local_port;
+  header.transport = static_cast<uint8_t>(transport);
+  header.peer_address = peer.sin_addr.s_addr;
+  header.peer_port = peer.sin_port;
+  header.size = min<size_t>(size, UINT16_MAX);
+  header.direction = static_cast<uint8_t>(direction);
+
+  lock_guard<mutex> lock(mutex_);
+  if (is_open_)
+    write_record(header, data);
+}
+
+void ExchangeRecorder::write_record(const ExchangeRecordHeader& header, const void* data)
+{
+  size_t record_size = sizeof(header) + get_padded_size(header.size);
+  reserve(size_ + record_size);
+
+  memcpy(memory_ + size_, &header, sizeof(header));
+  memcpy(memory_ + size_ + sizeof(header), data, header.size);
+  size_ += record_size;
+}
+
+void ExchangeRecorder::reserve(size_t size)
+{
+  if (size <= capacity_)
+    return;
+
+  size_t capacity = (size + grow_size_ - 1) / grow_size_ * grow_size_;
+  if (-1 == ftruncate(file_, capacity))
+    throw Exception("Failed to grow exchange log.");
+
+  void* memory = MAP_FAILED;
+  if (nullptr == memory_)
+    memory = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file_, 0);
+  else
+    memory = mremap(memory_, capacity_, capacity, MREMAP_MAYMOVE);
+
+  if (MAP_FAILED == memory)
+    throw Exception("Failed to map exchange log.");
+
+  memory_ = static_cast<byte*>(memory);
+  capacity_ = capacity;
+}
+
+
+/******************************* ExchangeLog **********************************/
+
+ExchangeLog::ExchangeLog(const string& path)
+{
+  int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat status;
+  if (-1 == file || -1 == fstat(file, &status))
+  {
+    stringstream stream;
+    stream << "Failed to open exchange log " << path << ". Error: " << strerror(errno);
+    if (-1 != file)
+      ::close(file);
+    throw Exception(stream.str());
+  }
+
+  size_ = status.st_size;
+  void* memory = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+  ::close(file);
+
+  if (MAP_FAILED == memory || size_ < sizeof(magic) || 0 != memcmp(memory, magic, sizeof(magic)))
+  {
+    if (MAP_FAILED != memory)
+      munmap(memory, size_);
+    throw Exception("Not an exchange log: " + path);
+  }
+  memory_ = static_cast<const byte*>(memory);
+
+  for (size_t offset = sizeof(magic); offset + sizeof(ExchangeRecordHeader) <= size_;)
+  {
+    ExchangeRecordHeader header;
+    memcpy(&header, memory_ + offset, sizeof(header));
+    offset += sizeof(header);
+
+    // Unused tail of a log which wasn't closed.
+    if (0 == header.timestamp || offset + header.size > size_)
+      break;
+
+    ExchangeRecord record;
+    record.direction = static_cast<ExchangeDirection>(header.direction);
+    record.transport = static_cast<ExchangeTransport>(header.transport);
+    record.timestamp.tv_sec = header.timestamp / 1000000000;
+    record.timestamp.tv_nsec = header.timestamp % 1000000000;
+    memset(&record.peer, 0, sizeof(record.peer));
+    record.peer.sin_family = AF_INET;
+    record.peer.sin_addr.s_addr = header.peer_address;
+    record.peer.sin_port = header.peer_port;
+    record.local_port = header.local_port;
+    record.data = memory_ + offset;
+    record.size = header.size;
+    records_.push_back(record);
+
+    offset += get_padded_size(header.size);
+  }
+}
+
+ExchangeLog::~ExchangeLog()
+{
+  munmap(const_cast<byte*>(memory_), size_);
+}
+
+const vector<ExchangeRecord>& ExchangeLog::get_records() const
+{
+  return records_;
+}
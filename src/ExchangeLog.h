@@ -0,0 +1,109 @@
+#ifndef EXCHANGE_LOG_H
+#define EXCHANGE_LOG_H
+
+#include <netinet/in.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Binary log of STUN datagrams. The file starts with an 8-byte magic, every
+// record is a fixed 24-byte header followed by data padded to 8 bytes.
+// Integers are in host byte order, peer addresses and ports as on the wire.
+// LocalAddress records keep addresses of local interfaces at capture time as
+// text, so a replay can tell public mapped addresses from translated ones.
+enum class ExchangeDirection : uint8_t
+{
+  Sent = 1,
+  Received = 2,
+  LocalAddress = 3
+};
+
+enum class ExchangeTransport : uint8_t
+{
+  Udp = 0,
+  Tcp = 1
+};
+
+struct ExchangeRecordHeader
+{
+  uint64_t timestamp;
+  uint32_t peer_address;
+  uint16_t peer_port;
+  uint16_t local_port;
+  uint16_t size;
+  uint8_t direction;
+  uint8_t transport;
+  uint8_t reserved[4];
+};
+
+struct ExchangeRecord
+{
+  ExchangeDirection direction;
+  ExchangeTransport transport;
+  timespec timestamp;
+  sockaddr_in peer;
+  size_t local_port;
+  const std::byte* data;
+  size_t size;
+};
+
+// Appends datagrams of every socket of the process to a memory-mapped log,
+// the file grows in large steps and is trimmed when closed. Records written
+// before a crash are kept, the reader stops at the first empty header.
+class ExchangeRecorder
+{
+public:
+  ExchangeRecorder(const ExchangeRecorder& recorder) = delete;
+  ExchangeRecorder& operator=(const ExchangeRecorder& recorder) = delete;
+  ~ExchangeRecorder();
+
+  static ExchangeRecorder& instance();
+
+  void open(const std::string& path);
+  void close();
+  bool is_open() const;
+
+  // Receive time falls back to the current time.
+  void record(ExchangeDirection direction, ExchangeTransport transport, size_t local_port, const sockaddr_in& peer,
+      const void* data, size_t size, const timespec* time = nullptr);
+
+private:
+  ExchangeRecorder() = default;
+
+  void write_record(const ExchangeRecordHeader& header, const void* data);
+  void reserve(size_t size);
+
+private:
+  static constexpr size_t grow_size_ = 1024 * 1024;
+
+  std::mutex mutex_;
+  std::atomic<bool> is_open_ = false;
+  int file_ = -1;
+  std::byte* memory_ = nullptr;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+};
+
+// Read-only view of a log, records point into the mapped file.
+class ExchangeLog
+{
+public:
+  explicit ExchangeLog(const std::string& path);
+  ExchangeLog(const ExchangeLog& log) = delete;
+  ExchangeLog& operator=(const ExchangeLog& log) = delete;
+  ~ExchangeLog();
+
+  const std::vector<ExchangeRecord>& get_records() const;
+
+private:
+  const std::byte* memory_ = nullptr;
+  size_t size_ = 0;
+  std::vector<ExchangeRecord> records_;
+};
+
+#endif /* end of include guard: EXCHANGE_LOG_H */
@@ -0,0 +1,217 @@
+#include "ExchangeReplay.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "Exception.h"
+#include "NatTypeDetector.h"
+#include "StunController.h"
+
+
+using namespace std;
+
+
+namespace
+{
+
+double get_milliseconds(const timespec& begin, const timespec& end)
+{
+  return (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+}
+
+}
+
+
+ExchangeReplay::ExchangeReplay(const string& path) : log_(path)
+{
+  load_transactions();
+}
+
+void ExchangeReplay::execute()
+{
+  size_t next = 0;
+  while (next < transactions_.size())
+    next = replay_detection(next);
+
+  if (0 == detections_number_)
+    cout << "No detection found in " << transactions_.size() << " recorded transactions." << endl;
+  if (0 != tcp_records_number_)
+    cout << tcp_records_number_ << " requests sent over TCP aren't replayed." << endl;
+}
+
+vector<vector<byte>> ExchangeReplay::get_received_packets() const
+{
+  vector<vector<byte>> packets;
+  for (auto& record : log_.get_records())
+  {
+    if (ExchangeDirection::Received == record.direction)
+      packets.emplace_back(record.data, record.data + record.size);
+  }
+
+  return packets;
+}
+
+void ExchangeReplay::load_transactions()
+{
+  map<TransactionId, size_t> indexes;
+
+  for (auto& record : log_.get_records())
+  {
+    if (ExchangeDirection::LocalAddress == record.direction)
+    {
+      local_addresses_.emplace(reinterpret_cast<const char*>(record.data), record.size);
+      continue;
+    }
+
+    // TCP fallback needs a live connection, its transactions are only counted.
+    if (ExchangeTransport::Tcp == record.transport)
+    {
+      tcp_records_number_ += ExchangeDirection::Sent == record.direction ? 1 : 0;
+      continue;
+    }
+
+    StunMessage message;
+    message.set_data(record.data, record.size);
+
+    if (ExchangeDirection::Sent == record.direction && StunMessageType::BindingRequest == message.get_type())
+    {
+      auto found = indexes.find(message.get_transaction_id());
+      if (end(indexes) != found)
+      {
+        ++transactions_[found->second].transmissions_number;
+        continue;
+      }
+
+      indexes.emplace(message.get_transaction_id(), transactions_.size());
+      transactions_.push_back(Transaction { message, &record, nullptr, 1 });
+    }
+    else if (ExchangeDirection::Received == record.direction &&
+        (StunMessageType::BindingSuccessResponse == message.get_type() ||
+         StunMessageType::BindingErrorResponse == message.get_type()))
+    {
+      auto found = indexes.find(message.get_transaction_id());
+      if (end(indexes) != found && nullptr == transactions_[found->second].response_record)
+        transactions_[found->second].response_record = &record;
+    }
+  }
+}
+
+size_t ExchangeReplay::replay_detection(size_t begin)
+{
+  // Only test 1 of the second server goes elsewhere than the first transaction.
+  string server1 = format_address(transactions_[begin].request_record->peer);
+  string server2 = server1;
+  for (size_t i = begin + 1; i < transactions_.size(); ++i)
+  {
+    string server = format_address(transactions_[i].request_record->peer);
+    if (server != server1)
+    {
+      server2 = server;
+      break;
+    }
+  }
+
+  NatTypeDetector detector;
+  detector.set_local_addresses(local_addresses_);
+  detector.start(server1, server2);
+
+  const ExchangeRecord& first_record = *transactions_[begin].request_record;
+  time_t start_time = first_record.timestamp.tv_sec;
+  cout << "Detection at " << put_time(localtime(&start_time), "%F %T") << ", servers: " << server1 << ", "
+    << server2 << endl;
+
+  size_t next = begin;
+  try
+  {
+    while (!detector.is_finished() && next < transactions_.size())
+    {
+      auto& transaction = transactions_[next];
+      if (get_change_flags(transaction.request) != get_change_flags(detector.get_request()))
+        throw Exception("Capture diverges from detection: recorded request doesn't match the expected test.");
+      ++next;
+
+      StunMessage response;
+      if (nullptr != transaction.response_record)
+      {
+        response.set_data(transaction.response_record->data, transaction.response_record->size);
+        print_transaction(transaction, response, first_record);
+        StunController::validate_message(response, transaction.request.get_transaction_id());
+      }
+      else
+        print_transaction(transaction, response, first_record);
+
+      detector.process_response(response);
+    }
+
+    if (!detector.is_finished())
+      throw Exception("Capture ends before detection is finished.");
+
+    ++detections_number_;
+    detector.print_result();
+  }
+  catch (const Exception& exception)
+  {
+    cout << exception.what() << endl;
+  }
+
+  cout << endl;
+
+  // A transaction which can't start a detection is skipped.
+  return max(next, begin + 1);
+}
+
+void ExchangeReplay::print_transaction(const Transaction& transaction, const StunMessage& response,
+    const ExchangeRecord& first_record) const
+{
+  auto& request_record = *transaction.request_record;
+  auto flags = cout.flags();
+  auto precision = cout.precision();
+
+  cout << "  +" << fixed << setprecision(3) << get_milliseconds(first_record.timestamp, request_record.timestamp)
+    << " ms " << format_address(request_record.peer) << " from port " << request_record.local_port
+    << ", change request: " << get_change_flags(transaction.request) << ", transmissions: "
+    << transaction.transmissions_number << ", ";
+
+  if (StunMessageType::Unknown == response.get_type())
+    cout << "no response" << endl;
+  else
+  {
+    cout << "response from " << format_address(transaction.response_record->peer) << " in "
+      << get_milliseconds(request_record.timestamp, transaction.response_record->timestamp) << " ms";
+
+    string address;
+    size_t port;
+    if (response.get_mapped_address(address, port))
+      cout << ", mapped: " << address << ":" << port;
+    cout << endl;
+  }
+
+  cout.flags(flags);
+  cout.precision(precision);
+}
+
+uint32_t ExchangeReplay::get_change_flags(const StunMessage& request)
+{
+  auto attribute = request.get_attribute(StunAttributeType::ChangeAddress);
+  if (nullptr == attribute || attribute->get_value().size() < sizeof(uint32_t))
+    return 0;
+
+  uint32_t flags;
+  memcpy(&flags, attribute->get_value().data(), sizeof(flags));
+
+  return ntohl(flags);
+}
+
+string ExchangeReplay::format_address(const sockaddr_in& address)
+{
+  char ip[INET_ADDRSTRLEN];
+  stringstream stream;
+  stream << inet_ntop(AF_INET, &address.sin_addr, ip, INET_ADDRSTRLEN) << ":" << ntohs(address.sin_port);
+
+  return stream.str();
+}
@@ -0,0 +1,55 @@
+#ifndef EXCHANGE_REPLAY_H
+#define EXCHANGE_REPLAY_H
+
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "ExchangeLog.h"
+#include "StunMessage.h"
+
+
+// Replays NAT type detections recorded in an exchange log without any network
+// I/O. Requests and responses are paired by transaction ID, transactions are
+// fed to the detector in order of their first transmission and must ask for
+// what the detector asks for (the same CHANGE-REQUEST), otherwise the capture
+// doesn't belong to a detection. Mapped addresses are compared with local
+// addresses of the capture. Each step and every verdict are printed.
+class ExchangeReplay
+{
+public:
+  explicit ExchangeReplay(const std::string& path);
+
+  void execute();
+
+  // Received datagrams, a corpus for the decode benchmark.
+  std::vector<std::vector<std::byte>> get_received_packets() const;
+
+private:
+  struct Transaction
+  {
+    StunMessage request;
+    const ExchangeRecord* request_record;
+    const ExchangeRecord* response_record;
+    size_t transmissions_number;
+  };
+
+  void load_transactions();
+  // Returns index of the next transaction to replay.
+  size_t replay_detection(size_t begin);
+  void print_transaction(const Transaction& transaction, const StunMessage& response,
+      const ExchangeRecord& first_record) const;
+
+  static uint32_t get_change_flags(const StunMessage& request);
+  static std::string format_address(const sockaddr_in& address);
+
+private:
+  ExchangeLog log_;
+  std::unordered_set<std::string> local_addresses_;
+  std::vector<Transaction> transactions_;
+  size_t detections_number_ = 0;
+  size_t tcp_records_number_ = 0;
+};
+
+#endif /* end of include guard: EXCHANGE_REPLAY_H */
@@ -0,0 +1,502 @@
+#include "KeepaliveScheduler.h"
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <random>
+
+#include "Exception.h"
+#include "ExchangeLog.h"
+#include "StunController.h"
+#include "StunMessage.h"
+#include "Tracepoints.h"
+
+
+using namespace std;
+
+
+KeepaliveScheduler::KeepaliveScheduler(chrono::milliseconds tick, double jitter) :
+  tick_(max(tick, chrono::milliseconds(1))), jitter_(min(max(jitter, 0.0), 1.0))
+{
+  epoll_ = epoll_create1(EPOLL_CLOEXEC);
+  if (-1 == epoll_)
+    throw Exception("Failed to create epoll descriptor.");
+
+  for (auto& level : wheel_)
+    level.fill(invalid_index_);
+
+  random_device device;
+  random_state_ = (static_cast<uint64_t>(device()) << 32) | device() | 1;
+
+  for (size_t i = 0; i < batch_size_; ++i)
+  {
+    vectors_[i].iov_base = buffers_[i].data();
+    vectors_[i].iov_len = buffers_[i].size();
+  }
+}
+
+KeepaliveScheduler::~KeepaliveScheduler()
+{
+  if (epoll_ != -1)
+    close(epoll_);
+}
+
+size_t KeepaliveScheduler::add_socket(StunController& controller)
+{
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u32 = controllers_.size();
+
+  if (-1 == epoll_ctl(epoll_, EPOLL_CTL_ADD, controller.get_socket(), &event))
+    throw Exception("Failed to add socket to epoll descriptor.");
+
+  controllers_.push_back(&controller);
+
+  return controllers_.size() - 1;
+}
+
+KeepaliveScheduler::BindingId KeepaliveScheduler::add_binding(size_t socket_index, const string& server,
+    size_t port, chrono::milliseconds interval)
+{
+  if (socket_index >= controllers_.size())
+    throw Exception("Failed to add binding: unknown socket.");
+
+  auto key = make_pair(server, port);
+  auto found = server_addresses_.find(key);
+  if (end(server_addresses_) == found)
+    found = server_addresses_.emplace(key, controllers_[socket_index]->resolve_server_address(server, port)).first;
+
+  uint32_t index;
+  if (!free_bindings_.empty())
+  {
+    index = free_bindings_.back();
+    free_bindings_.pop_back();
+  }
+  else
+  {
+    index = bindings_.size();
+    bindings_.emplace_back();
+  }
+
+  Binding& binding = bindings_[index];
+  memset(&binding, 0, sizeof(binding));
+  binding.server = found->second;
+  binding.socket_index = socket_index;
+  binding.interval = max<uint64_t>(interval / tick_, 1);
+  binding.next = binding.previous = invalid_index_;
+  binding.is_active = true;
+  ++bindings_number_;
+
+  // The first refresh creates the mapping, bindings added together are spread over up to a second.
+  uint64_t spread = min<uint64_t>(binding.interval, max<uint64_t>(chrono::milliseconds(1000) / tick_, 1));
+  schedule(index, 1 + next_random() % spread);
+
+  return index;
+}
+
+void KeepaliveScheduler::remove_binding(BindingId binding)
+{
+  if (binding >= bindings_.size() || !bindings_[binding].is_active)
+    return;
+
+  unlink(binding);
+  bindings_[binding].is_active = false;
+  free_bindings_.push_back(binding);
+  --bindings_number_;
+}
+
+void KeepaliveScheduler::set_change_handler(ChangeHandler handler)
+{
+  change_handler_ = move(handler);
+}
+
+void KeepaliveScheduler::run()
+{
+  is_stopped_ = false;
+  auto start_time = chrono::steady_clock::now() - current_tick_ * tick_;
+
+  array<epoll_event, batch_size_> events;
+  while (!is_stopped_)
+  {
+    auto next_tick_time = start_time + (current_tick_ + 1) * tick_;
+    auto now = chrono::steady_clock::now();
+    int timeout = next_tick_time > now ?
+      chrono::duration_cast<chrono::milliseconds>(next_tick_time - now).count() + 1 : 0;
+
+    int events_number = epoll_wait(epoll_, events.data(), events.size(), timeout);
+    if (-1 == events_number && EINTR != errno)
+      throw Exception("Failed to wait for sockets.");
+
+    for (int i = 0; i < events_number; ++i)
+      receive(events[i].data.u32);
+
+    // Late ticks are caught up one by one, so no binding is skipped.
+    now = chrono::steady_clock::now();
+    while (!is_stopped_ && start_time + (current_tick_ + 1) * tick_ <= now)
+      advance();
+  }
+}
+
+void KeepaliveScheduler::stop()
+{
+  is_stopped_ = true;
+}
+
+size_t KeepaliveScheduler::get_bindings_number() const
+{
+  return bindings_number_;
+}
+
+void KeepaliveScheduler::schedule(uint32_t index, uint64_t delay)
+{
+  const uint64_t max_delay = (uint64_t(1) << (slot_bits_ * levels_number_)) - 1;
+  bindings_[index].expiry = current_tick_ + min(max(delay, uint64_t(1)), max_delay);
+  link(index);
+}
+
+void KeepaliveScheduler::link(uint32_t index)
+{
+  Binding& binding = bindings_[index];
+  uint64_t delta = binding.expiry > current_tick_ ? binding.expiry - current_tick_ : 0;
+  uint64_t expiry = max(binding.expiry, current_tick_);
+
+  size_t level = 0;
+  while (level + 1 < levels_number_ && delta >= (uint64_t(1) << (slot_bits_ * (level + 1))))
+    ++level;
+
+  uint32_t& head = wheel_[level][(expiry >> (slot_bits_ * level)) & (slots_number_ - 1)];
+  binding.previous = invalid_index_;
+  binding.next = head;
+  if (invalid_index_ != head)
+    bindings_[head].previous = index;
+  head = index;
+
+  // Level and slot are found again from expiry when the binding is unlinked.
+  binding.expiry = expiry;
+}
+
+void KeepaliveScheduler::unlink(uint32_t index)
+{
+  Binding& binding = bindings_[index];
+
+  if (invalid_index_ != binding.previous)
+    bindings_[binding.previous].next = binding.next;
+  else
+  {
+    // The binding heads its slot list, which slot it is has to be searched.
+    for (auto& level : wheel_)
+    {
+      auto head = find(begin(level), end(level), index);
+      if (end(level) != head)
+      {
+        *head = binding.next;
+        break;
+      }
+    }
+  }
+
+  if (invalid_index_ != binding.next)
+    bindings_[binding.next].previous = binding.previous;
+
+  binding.next = binding.previous = invalid_index_;
+}
+
+void KeepaliveScheduler::advance()
+{
+  ++current_tick_;
+
+  for (size_t level = 1; level < levels_number_; ++level)
+  {
+    if (0 != (current_tick_ & ((uint64_t(1) << (slot_bits_ * level)) - 1)))
+      break;
+
+    cascade(level);
+  }
+
+  uint32_t& head = wheel_[0][current_tick_ & (slots_number_ - 1)];
+  due_bindings_.clear();
+  for (uint32_t index = head; invalid_index_ != index; index = bindings_[index].next)
+    due_bindings_.push_back(index);
+  head = invalid_index_;
+
+  for (auto index : due_bindings_)
+    bindings_[index].next = bindings_[index].previous = invalid_index_;
+
+  send_refreshes();
+}
+
+void KeepaliveScheduler::cascade(size_t level)
+{
+  uint32_t& head = wheel_[level][(current_tick_ >> (slot_bits_ * level)) & (slots_number_ - 1)];
+  uint32_t index = head;
+  head = invalid_index_;
+
+  while (invalid_index_ != index)
+  {
+    uint32_t next = bindings_[index].next;
+    link(index);
+    index = next;
+  }
+}
+
+void KeepaliveScheduler::send_refreshes()
+{
+  // Refreshes of one socket go out in one sendmmsg.
+  sort(begin(due_bindings_), end(due_bindings_), [this](uint32_t left, uint32_t right)
+      {
+        return bindings_[left].socket_index < bindings_[right].socket_index;
+      });
+
+  size_t begin = 0;
+  while (begin < due_bindings_.size())
+  {
+    size_t end = begin + 1;
+    while (end < due_bindings_.size() && end - begin < batch_size_ &&
+        bindings_[due_bindings_[end]].socket_index == bindings_[due_bindings_[begin]].socket_index)
+      ++end;
+
+    send_batch(begin, end);
+    begin = end;
+  }
+}
+
+bool KeepaliveScheduler::is_due(uint32_t index) const
+{
+  // Change handlers may remove a due binding and add a new one with the same
+  // index, it is already scheduled and must not be linked again.
+  return bindings_[index].is_active && current_tick_ == bindings_[index].expiry;
+}
+
+void KeepaliveScheduler::send_batch(size_t begin, size_t end)
+{
+  size_t messages_number = 0;
+  uint32_t socket_index = bindings_[due_bindings_[begin]].socket_index;
+
+  for (size_t i = begin; i < end; ++i)
+  {
+    uint32_t index = due_bindings_[i];
+    if (!is_due(index))
+      continue;
+
+    // A refresh still waiting for its response counts as missed.
+    if (TransactionId {} != bindings_[index].transaction_id && ++bindings_[index].missed_number == missed_threshold_ &&
+        0 != bindings_[index].mapped_port)
+    {
+      uint32_t previous_address = bindings_[index].mapped_address;
+      uint16_t previous_port = bindings_[index].mapped_port;
+      bindings_[index].mapped_address = 0;
+      bindings_[index].mapped_port = 0;
+      notify(index, previous_address, previous_port);
+
+      if (!is_due(index))
+        continue;
+    }
+
+    Binding& binding = bindings_[index];
+    uint64_t random = next_random();
+    binding.transaction_id = { static_cast<uint32_t>(random) | 1, static_cast<uint32_t>(random >> 32), index };
+
+    StunMessageHeader header;
+    header.type = htons(StunMessageType::BindingRequest);
+    header.length = 0;
+    header.magic = htonl(MAGIC_COOKIE);
+    header.transaction_id = binding.transaction_id;
+    memcpy(buffers_[messages_number].data(), &header, sizeof(header));
+    // Handlers may add bindings and move them, so the batch keeps its own copy of addresses.
+    addresses_[messages_number] = binding.server;
+
+    vectors_[messages_number].iov_len = sizeof(header);
+    memset(&headers_[messages_number], 0, sizeof(mmsghdr));
+    headers_[messages_number].msg_hdr.msg_name = &addresses_[messages_number];
+    headers_[messages_number].msg_hdr.msg_namelen = sizeof(addresses_[messages_number]);
+    headers_[messages_number].msg_hdr.msg_iov = &vectors_[messages_number];
+    headers_[messages_number].msg_hdr.msg_iovlen = 1;
+    ++messages_number;
+
+    schedule(index, make_jittered_delay(binding.interval));
+  }
+
+  size_t sent_number = 0;
+  while (sent_number < messages_number)
+  {
+    int result = sendmmsg(controllers_[socket_index]->get_socket(), headers_.data() + sent_number,
+        messages_number - sent_number, MSG_DONTWAIT);
+    if (-1 == result)
+    {
+      if (EINTR == errno)
+        continue;
+
+      // Not sent refreshes are treated as lost ones.
+      break;
+    }
+
+    sent_number += result;
+  }
+
+  for (size_t i = 0; i < sent_number; ++i)
+    TRACE_TRANSMIT(reinterpret_cast<const StunMessageHeader*>(buffers_[i].data())->transaction_id,
+        controllers_[socket_index]->get_socket(), vectors_[i].iov_len);
+
+  if (ExchangeRecorder::instance().is_open())
+  {
+    for (size_t i = 0; i < sent_number; ++i)
+      ExchangeRecorder::instance().record(ExchangeDirection::Sent, ExchangeTransport::Udp,
+          controllers_[socket_index]->get_local_port(), addresses_[i], buffers_[i].data(), vectors_[i].iov_len);
+  }
+
+  for (size_t i = 0; i < messages_number; ++i)
+    vectors_[i].iov_len = buffers_[i].size();
+}
+
+void KeepaliveScheduler::receive(size_t socket_index)
+{
+  int socket = controllers_[socket_index]->get_socket();
+
+  while (true)
+  {
+    for (size_t i = 0; i < batch_size_; ++i)
+    {
+      memset(&headers_[i], 0, sizeof(mmsghdr));
+      headers_[i].msg_hdr.msg_name = &addresses_[i];
+      headers_[i].msg_hdr.msg_namelen = sizeof(addresses_[i]);
+      headers_[i].msg_hdr.msg_iov = &vectors_[i];
+      headers_[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int received_number = recvmmsg(socket, headers_.data(), batch_size_, MSG_DONTWAIT, nullptr);
+    if (received_number <= 0)
+      return;
+
+    for (int i = 0; i < received_number; ++i)
+      TRACE_RECEIVE(socket, headers_[i].msg_len, addresses_[i].sin_addr.s_addr, addresses_[i].sin_port,
+          buffers_[i].data());
+
+    if (ExchangeRecorder::instance().is_open())
+    {
+      for (int i = 0; i < received_number; ++i)
+        ExchangeRecorder::instance().record(ExchangeDirection::Received, ExchangeTransport::Udp,
+            controllers_[socket_index]->get_local_port(), addresses_[i], buffers_[i].data(), headers_[i].msg_len);
+    }
+
+    for (int i = 0; i < received_number; ++i)
+      process_response(buffers_[i].data(), headers_[i].msg_len);
+
+    if (received_number < static_cast<int>(batch_size_))
+      return;
+  }
+}
+
+void KeepaliveScheduler::process_response(const byte* data, size_t size)
+{
+  StunMessageHeader header;
+  if (size < sizeof(header))
+    return;
+
+  memcpy(&header, data, sizeof(header));
+  if (StunMessageType::BindingSuccessResponse != ntohs(header.type) || MAGIC_COOKIE != ntohl(header.magic))
+    return;
+
+  uint32_t index = header.transaction_id[2];
+  if (index >= bindings_.size() || !bindings_[index].is_active ||
+      bindings_[index].transaction_id != header.transaction_id)
+    return;
+
+  uint32_t address = 0;
+  uint16_t port = 0;
+  bool is_xor_found = false;
+  size_t attributes_number = 0;
+  size_t end = min(size, sizeof(header) + ntohs(header.length));
+  for (size_t offset = sizeof(header); offset + sizeof(StunAttributeHeader) <= end; ++attributes_number)
+  {
+    StunAttributeHeader attribute;
+    memcpy(&attribute, data + offset, sizeof(attribute));
+    offset += sizeof(attribute);
+
+    uint16_t type = ntohs(attribute.type);
+    uint16_t length = ntohs(attribute.length);
+    bool is_xor = StunAttributeType::XorMappedAddress1 == type || StunAttributeType::XorMappedAddress2 == type;
+
+    // XOR-MAPPED-ADDRESS wins over MAPPED-ADDRESS.
+    if ((is_xor || (StunAttributeType::MappedAddress == type && !is_xor_found)) && length >= 8 &&
+        offset + 8 <= end && AddressFamily::IPv4 == static_cast<uint8_t>(data[offset + 1]))
+    {
+      memcpy(&port, data + offset + 2, sizeof(port));
+      memcpy(&address, data + offset + 4, sizeof(address));
+
+      if (is_xor)
+      {
+        port = htons(ntohs(port) ^ (MAGIC_COOKIE >> 16));
+        address ^= htonl(MAGIC_COOKIE);
+        is_xor_found = true;
+      }
+    }
+
+    offset += (length + 3) / 4 * 4;
+  }
+
+  // The whole message is walked, so the probe reports the same attribute count as StunMessage::set_data.
+  TRACE_DECODE(header.transaction_id, ntohs(header.type), attributes_number);
+
+  if (0 == port)
+    return;
+
+  Binding& binding = bindings_[index];
+  binding.transaction_id = TransactionId {};
+  binding.missed_number = 0;
+
+  if (address == binding.mapped_address && port == binding.mapped_port)
+    return;
+
+  uint32_t previous_address = binding.mapped_address;
+  uint16_t previous_port = binding.mapped_port;
+  binding.mapped_address = address;
+  binding.mapped_port = port;
+  notify(index, previous_address, previous_port);
+}
+
+uint64_t KeepaliveScheduler::make_jittered_delay(uint32_t interval)
+{
+  // Refreshes are only moved earlier, so a binding is never refreshed later than its interval.
+  uint64_t jitter = static_cast<uint64_t>(interval * jitter_);
+  if (0 == jitter)
+    return interval;
+
+  return max<uint64_t>(interval - next_random() % (jitter + 1), 1);
+}
+
+uint64_t KeepaliveScheduler::next_random()
+{
+  // xorshift64*
+  random_state_ ^= random_state_ >> 12;
+  random_state_ ^= random_state_ << 25;
+  random_state_ ^= random_state_ >> 27;
+
+  return random_state_ * 0x2545F4914F6CDD1DULL;
+}
+
+void KeepaliveScheduler::notify(BindingId binding, uint32_t previous_address, uint16_t previous_port)
+{
+  if (!change_handler_)
+    return;
+
+  string previous = 0 == previous_port ? string() : format_address(previous_address, previous_port);
+  string current = 0 == bindings_[binding].mapped_port ? string() :
+    format_address(bindings_[binding].mapped_address, bindings_[binding].mapped_port);
+
+  change_handler_(binding, previous, current);
+}
+
+string KeepaliveScheduler::format_address(uint32_t address, uint16_t port)
+{
+  struct in_addr ip_address;
+  ip_address.s_addr = address;
+
+  char ip[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &ip_address, ip, INET_ADDRSTRLEN);
+
+  return string(ip) + ":" + to_string(ntohs(port));
+}
@@ -0,0 +1,129 @@
+#ifndef KEEPALIVE_SCHEDULER_H
+#define KEEPALIVE_SCHEDULER_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "StunAttribute.h"
+
+
+class StunController;
+
+
+// Keeps a large number of NAT bindings alive from a single thread. A binding is
+// a (socket, server) pair refreshed with a bare binding request every interval.
+// Bindings live in a flat array of fixed-size records and are scheduled on a
+// hierarchical timer wheel; refreshes due in the same tick are grouped per
+// socket and sent with sendmmsg, responses are read with recvmmsg and matched
+// to bindings by the index stored in the transaction ID, without allocations.
+// Refresh times are jittered so bindings added together don't stay in step.
+class KeepaliveScheduler
+{
+public:
+  using BindingId = uint32_t;
+  // Called when mapped address of a binding is learned or changes (previous is
+  // empty for the first response) and when a binding misses too many responses
+  // (current is empty).
+  using ChangeHandler = std::function<void(BindingId binding, const std::string& previous,
+      const std::string& current)>;
+
+  explicit KeepaliveScheduler(std::chrono::milliseconds tick = std::chrono::milliseconds(10), double jitter = 0.1);
+  KeepaliveScheduler(const KeepaliveScheduler& scheduler) = delete;
+  KeepaliveScheduler& operator=(const KeepaliveScheduler& scheduler) = delete;
+  ~KeepaliveScheduler();
+
+  size_t add_socket(StunController& controller);
+  BindingId add_binding(size_t socket_index, const std::string& server, size_t port,
+      std::chrono::milliseconds interval);
+  void remove_binding(BindingId binding);
+
+  void set_change_handler(ChangeHandler handler);
+
+  // Runs until stop() is called from a handler.
+  void run();
+  void stop();
+
+  size_t get_bindings_number() const;
+
+private:
+  static constexpr uint32_t invalid_index_ = UINT32_MAX;
+  static constexpr size_t slot_bits_ = 6;
+  static constexpr size_t slots_number_ = 1 << slot_bits_;
+  static constexpr size_t levels_number_ = 4;
+  static constexpr size_t batch_size_ = 64;
+  static constexpr size_t datagram_size_ = 1500;
+  static constexpr uint8_t missed_threshold_ = 3;
+
+  struct Binding
+  {
+    sockaddr_in server;
+    TransactionId transaction_id;
+    uint32_t socket_index;
+    uint32_t interval;
+    uint64_t expiry;
+    uint32_t next;
+    uint32_t previous;
+    uint32_t mapped_address;
+    uint16_t mapped_port;
+    uint8_t missed_number;
+    bool is_active;
+  };
+  static_assert(sizeof(Binding) == 64, "Binding has to fit a cache line");
+
+  bool is_due(uint32_t index) const;
+
+  void schedule(uint32_t index, uint64_t delay);
+  void link(uint32_t index);
+  void unlink(uint32_t index);
+  void advance();
+  void cascade(size_t level);
+
+  void send_refreshes();
+  void send_batch(size_t begin, size_t end);
+  void receive(size_t socket_index);
+  void process_response(const std::byte* data, size_t size);
+
+  uint64_t make_jittered_delay(uint32_t interval);
+  uint64_t next_random();
+
+  void notify(BindingId binding, uint32_t previous_address, uint16_t previous_port);
+  static std::string format_address(uint32_t address, uint16_t port);
+
+private:
+  std::chrono::milliseconds tick_;
+  double jitter_;
+  bool is_stopped_ = false;
+
+  int epoll_ = -1;
+  std::vector<StunController*> controllers_;
+  std::map<std::pair<std::string, size_t>, sockaddr_in> server_addresses_;
+
+  std::vector<Binding> bindings_;
+  std::vector<uint32_t> free_bindings_;
+  size_t bindings_number_ = 0;
+
+  uint64_t current_tick_ = 0;
+  std::array<std::array<uint32_t, slots_number_>, levels_number_> wheel_;
+  std::vector<uint32_t> due_bindings_;
+
+  uint64_t random_state_;
+
+  // Buffers reused by every batch, aligned so that headers can be read in place.
+  alignas(uint32_t) std::array<std::array<std::byte, datagram_size_>, batch_size_> buffers_;
+  std::array<sockaddr_in, batch_size_> addresses_;
+  std::array<iovec, batch_size_> vectors_;
+  std::array<mmsghdr, batch_size_> headers_;
+
+  ChangeHandler change_handler_;
+};
+
+#endif /* end of include guard: KEEPALIVE_SCHEDULER_H */
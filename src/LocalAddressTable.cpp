@@ -0,0 +1,149 @@
+#include "LocalAddressTable.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include "Exception.h"
+
+
+using namespace std;
+
+
+LocalAddressTable::LocalAddressTable()
+{
+  socket_ = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (-1 != socket_)
+  {
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+    if (-1 == bind(socket_, (struct sockaddr *) &address, sizeof(address)))
+    {
+      close(socket_);
+      socket_ = -1;
+    }
+  }
+
+  // Subscription is made first, so a change between both calls isn't lost.
+  load_addresses();
+}
+
+LocalAddressTable::~LocalAddressTable()
+{
+  if (socket_ != -1)
+    close(socket_);
+}
+
+LocalAddressTable& LocalAddressTable::instance()
+{
+  static LocalAddressTable table;
+
+  return table;
+}
+
+bool LocalAddressTable::contains(const string& address) const
+{
+  return addresses_.find(address) != end(addresses_);
+}
+
+const unordered_set<string>& LocalAddressTable::get_addresses() const
+{
+  return addresses_;
+}
+
+bool LocalAddressTable::update()
+{
+  if (-1 == socket_)
+    return false;
+
+  bool is_changed = false;
+  vector<char> buffer(8192);
+
+  while (true)
+  {
+    ssize_t size = recv(socket_, buffer.data(), buffer.size(), 0);
+    if (-1 == size)
+    {
+      // Notifications were dropped, the table can't be trusted anymore.
+      if (ENOBUFS == errno)
+      {
+        is_changed = true;
+        continue;
+      }
+
+      break;
+    }
+
+    for (auto header = reinterpret_cast<struct nlmsghdr*>(buffer.data()); NLMSG_OK(header, size);
+        header = NLMSG_NEXT(header, size))
+    {
+      if (RTM_NEWADDR == header->nlmsg_type || RTM_DELADDR == header->nlmsg_type)
+        is_changed = true;
+    }
+  }
+
+  if (is_changed)
+  {
+    auto previous_addresses = addresses_;
+    load_addresses();
+    is_changed = previous_addresses != addresses_;
+  }
+
+  if (is_changed)
+    ++generation_;
+
+  return is_changed;
+}
+
+int LocalAddressTable::get_socket() const
+{
+  return socket_;
+}
+
+uint64_t LocalAddressTable::get_generation() const
+{
+  return generation_;
+}
+
+void LocalAddressTable::load_addresses()
+{
+  struct ifaddrs* addresses;
+  if (-1 == getifaddrs(&addresses))
+    throw Exception("Failed to get addresses of network interfaces.");
+
+  addresses_.clear();
+  for (auto address = addresses; nullptr != address; address = address->ifa_next)
+  {
+    if (nullptr == address->ifa_addr)
+      continue;
+
+    char ip[INET6_ADDRSTRLEN];
+    const char* result = nullptr;
+    if (AF_INET == address->ifa_addr->sa_family)
+    {
+      auto ip_address = reinterpret_cast<struct sockaddr_in*>(address->ifa_addr);
+      result = inet_ntop(AF_INET, &ip_address->sin_addr, ip, sizeof(ip));
+    }
+    else if (AF_INET6 == address->ifa_addr->sa_family)
+    {
+      auto ip_address = reinterpret_cast<struct sockaddr_in6*>(address->ifa_addr);
+      result = inet_ntop(AF_INET6, &ip_address->sin6_addr, ip, sizeof(ip));
+    }
+
+    if (nullptr != result)
+      addresses_.insert(result);
+  }
+
+  freeifaddrs(addresses);
+}
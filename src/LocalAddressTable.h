@@ -0,0 +1,44 @@
+#ifndef LOCAL_ADDRESS_TABLE_H
+#define LOCAL_ADDRESS_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+
+
+// Set of IPv4 and IPv6 addresses assigned to local interfaces. The table is
+// built once with getifaddrs and rebuilt when RTNETLINK reports that an
+// address was added or removed, so a lookup doesn't touch the network stack.
+class LocalAddressTable
+{
+public:
+  LocalAddressTable(const LocalAddressTable& table) = delete;
+  LocalAddressTable& operator=(const LocalAddressTable& table) = delete;
+  ~LocalAddressTable();
+
+  static LocalAddressTable& instance();
+
+  bool contains(const std::string& address) const;
+  const std::unordered_set<std::string>& get_addresses() const;
+
+  // Processes pending RTNETLINK notifications without blocking. Returns true
+  // if the set of local addresses has changed.
+  bool update();
+
+  // Netlink socket for poll(), -1 if notifications are not available.
+  int get_socket() const;
+  // Incremented on every change of local addresses.
+  uint64_t get_generation() const;
+
+private:
+  LocalAddressTable();
+
+  void load_addresses();
+
+private:
+  int socket_ = -1;
+  uint64_t generation_ = 0;
+  std::unordered_set<std::string> addresses_;
+};
+
+#endif /* end of include guard: LOCAL_ADDRESS_TABLE_H */
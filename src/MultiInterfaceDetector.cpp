@@ -0,0 +1,93 @@
+#include "MultiInterfaceDetector.h"
+
+#include <iostream>
+
+#include "Exception.h"
+
+
+using namespace std;
+
+
+MultiInterfaceDetector::MultiInterfaceDetector(bool is_bind_to_device) : is_bind_to_device_(is_bind_to_device)
+{}
+
+void MultiInterfaceDetector::execute(const string& server1, const string& server2)
+{
+  auto interfaces = get_network_interfaces();
+  if (interfaces.empty())
+    throw Exception("No network interfaces with IPv4 address found.");
+
+  detections_.clear();
+  detections_.reserve(interfaces.size());
+
+  for (auto& network_interface : interfaces)
+  {
+    Detection detection { network_interface, nullptr, nullptr };
+    try
+    {
+      detection.controller = make_unique<StunController>(network_interface.address,
+          is_bind_to_device_ ? network_interface.name : string());
+    }
+    catch (const Exception& exception)
+    {
+      print_result(detection, exception.what());
+      continue;
+    }
+
+    detection.detector = make_unique<NatTypeDetector>(*detection.controller);
+    detections_.push_back(move(detection));
+  }
+
+  for (auto& detection : detections_)
+  {
+    detection.detector->start(server1, server2);
+    send_request(detection);
+  }
+
+  loop_.run();
+}
+
+void MultiInterfaceDetector::send_request(Detection& detection)
+{
+  try
+  {
+    loop_.add_transaction(*detection.controller, detection.detector->get_request(),
+        [this, &detection](const StunMessage& response) { process_response(detection, response); },
+        attempts_number_, rto_);
+  }
+  catch (const Exception& exception)
+  {
+    print_result(detection, exception.what());
+  }
+}
+
+void MultiInterfaceDetector::process_response(Detection& detection, const StunMessage& response)
+{
+  try
+  {
+    detection.detector->process_response(response);
+  }
+  catch (const Exception& exception)
+  {
+    print_result(detection, exception.what());
+    return;
+  }
+
+  if (detection.detector->is_finished())
+    print_result(detection);
+  else
+    send_request(detection);
+}
+
+void MultiInterfaceDetector::print_result(const Detection& detection, const string& error) const
+{
+  cout << "Interface: " << detection.network_interface.name << " (" << detection.network_interface.address << ")"
+    << endl;
+
+  if (error.empty())
+    detection.detector->print_result();
+  else
+    cout << "Error: " << error << endl;
+
+  cout << endl;
+}
@@ -0,0 +1,48 @@
+#ifndef MULTI_INTERFACE_DETECTOR_H
+#define MULTI_INTERFACE_DETECTOR_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "NatTypeDetector.h"
+#include "NetworkInterface.h"
+#include "StunController.h"
+#include "StunTransactionLoop.h"
+
+
+// Detects NAT type from every local interface at once: one socket is bound per
+// interface address and all detections share one StunTransactionLoop. A result
+// is printed as soon as detection of the interface is finished.
+class MultiInterfaceDetector
+{
+public:
+  explicit MultiInterfaceDetector(bool is_bind_to_device = false);
+
+  void execute(const std::string& server1, const std::string& server2);
+
+private:
+  struct Detection
+  {
+    NetworkInterface network_interface;
+    std::unique_ptr<StunController> controller;
+    std::unique_ptr<NatTypeDetector> detector;
+  };
+
+  void send_request(Detection& detection);
+  void process_response(Detection& detection, const StunMessage& response);
+
+  void print_result(const Detection& detection, const std::string& error = std::string()) const;
+
+private:
+  // Retransmissions fit into the one second the blocking detection waits for a response.
+  static const size_t attempts_number_ = 2;
+  static const size_t rto_ = 333;
+
+  bool is_bind_to_device_;
+
+  StunTransactionLoop loop_;
+  std::vector<Detection> detections_;
+};
+
+#endif /* end of include guard: MULTI_INTERFACE_DETECTOR_H */
@@ -0,0 +1,158 @@
+#include "NatMonitor.h"
+
+#include <poll.h>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "Exception.h"
+#include "LocalAddressTable.h"
+#include "StunController.h"
+#include "StunTransactionLoop.h"
+
+
+using namespace std;
+
+
+NatMonitor::NatMonitor(size_t probe_interval, size_t failures_threshold) :
+  probe_interval_(probe_interval), failures_threshold_(failures_threshold)
+{}
+
+void NatMonitor::execute(const string& server1, const string& server2)
+{
+  server1_ = server1;
+  server2_ = server2;
+
+  bool is_classified = classify();
+  size_t failures_number = 0;
+
+  while (true)
+  {
+    if (wait_for_probe())
+    {
+      notify("Local addresses changed");
+      is_classified = classify();
+      failures_number = 0;
+      continue;
+    }
+
+    string address;
+    size_t port;
+    if (!probe(address, port))
+    {
+      if (++failures_number < failures_threshold_)
+        continue;
+
+      stringstream stream;
+      stream << failures_number << " probes in a row failed";
+      notify(stream.str());
+      is_classified = classify();
+      failures_number = 0;
+      continue;
+    }
+
+    failures_number = 0;
+
+    if (!is_classified)
+    {
+      is_classified = classify();
+      continue;
+    }
+
+    // Baseline probe after the detection failed, the mapping isn't known to have changed.
+    if (!is_baseline_taken_)
+    {
+      mapped_address_ = address;
+      mapped_port_ = port;
+      is_baseline_taken_ = true;
+      continue;
+    }
+
+    if (address == mapped_address_ && port == mapped_port_)
+      continue;
+
+    stringstream stream;
+    stream << "Mapping changed: " << mapped_address_ << ":" << mapped_port_ << " -> " << address << ":" << port;
+    notify(stream.str());
+    is_classified = classify();
+  }
+}
+
+bool NatMonitor::classify()
+{
+  // Late or duplicated responses of earlier probes would fail validation of the blocking detection.
+  detector_.get_controller().discard_messages();
+
+  try
+  {
+    detector_.execute(server1_, server2_);
+  }
+  catch (const Exception& exception)
+  {
+    notify(exception.what());
+
+    return false;
+  }
+
+  notify(format_result(detector_.get_result(), ", "));
+
+  // Public IP of the result may come from a test of server2, so the baseline is
+  // taken from server1 which is probed later.
+  is_baseline_taken_ = probe(mapped_address_, mapped_port_);
+
+  return true;
+}
+
+bool NatMonitor::probe(string& address, size_t& port) const
+{
+  StunMessage request(server1_, DEFAULT_PORT, StunMessageType::BindingRequest);
+
+  StunMessage response;
+  StunTransactionLoop loop;
+  try
+  {
+    loop.add_transaction(detector_.get_controller(), request,
+        [&response](const StunMessage& message) { response = message; },
+        probe_attempts_number_, NatTypeDetector::get_rto());
+    loop.run();
+  }
+  catch (const Exception& exception)
+  {
+    notify(exception.what());
+
+    return false;
+  }
+
+  return StunMessageType::BindingSuccessResponse == response.get_type() &&
+    response.get_mapped_address(address, port);
+}
+
+bool NatMonitor::wait_for_probe() const
+{
+  LocalAddressTable& local_addresses = LocalAddressTable::instance();
+  uint64_t generation = local_addresses.get_generation();
+
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(probe_interval_);
+  while (true)
+  {
+    local_addresses.update();
+    if (local_addresses.get_generation() != generation)
+      return true;
+
+    auto now = chrono::steady_clock::now();
+    if (now >= deadline)
+      return false;
+
+    pollfd descriptor { local_addresses.get_socket(), POLLIN, 0 };
+    int timeout = chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1;
+    poll(&descriptor, -1 == descriptor.fd ? 0 : 1, timeout);
+  }
+}
+
+void NatMonitor::notify(const string& message) const
+{
+  time_t now = time(nullptr);
+  cout << "[" << put_time(localtime(&now), "%F %T") << "] " << message << endl;
+}
@@ -0,0 +1,44 @@
+#ifndef NAT_MONITOR_H
+#define NAT_MONITOR_H
+
+#include <cstddef>
+#include <string>
+
+#include "NatTypeDetector.h"
+
+
+// Watches NAT mapping after the first full detection. Only a single binding
+// request is sent to server1 every probe interval from the detection socket;
+// full re-classification runs when the mapped address or port changes, when
+// several probes in a row fail or when local addresses change.
+class NatMonitor
+{
+public:
+  NatMonitor(size_t probe_interval, size_t failures_threshold = 3);
+
+  // Runs until the process is stopped.
+  void execute(const std::string& server1, const std::string& server2);
+
+private:
+  bool classify();
+  bool probe(std::string& address, size_t& port) const;
+  bool wait_for_probe() const;
+
+  void notify(const std::string& message) const;
+
+private:
+  static const size_t probe_attempts_number_ = 3;
+
+  size_t probe_interval_;
+  size_t failures_threshold_;
+
+  std::string server1_;
+  std::string server2_;
+
+  NatTypeDetector detector_;
+  std::string mapped_address_;
+  size_t mapped_port_ = 0;
+  bool is_baseline_taken_ = false;
+};
+
+#endif /* end of include guard: NAT_MONITOR_H */
@@ -1,31 +1,95 @@
 #include "NatTypeDetector.h"
 
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <cstring>
+#include <cstdlib>
 #include <iostream>
+#include <iomanip>
 #include <chrono>
 #include <thread>
 #include <sstream>
+#include <vector>
 
 #include "Exception.h"
+#include "LocalAddressTable.h"
+#include "ResultCache.h"
 #include "StunController.h"
+#include "StunTcpController.h"
 #include "StunMessage.h"
+#include "Tracepoints.h"
 
 
 using namespace std;
 
 
+/***************************** Helper functions *******************************/
+
+string format_result(const NatDetectionResult& result, const string& separator)
+{
+  stringstream stream;
+  stream << "NAT detected: " << (result.is_nat_present ? "YES" : "NO") << separator;
+  if (result.is_nat_present)
+    stream << "NAT type: " << result.nat_type;
+  else
+    stream << (result.is_firewall_present ? "Symmetric Firewall" : "Open Internet");
+  stream << separator << "Public IP: " << result.public_ip;
+
+  return stream.str();
+}
+
+void print_result(const NatDetectionResult& result)
+{
+  cout << format_result(result, "\n") << endl;
+}
+
+string serialize_result(const NatDetectionResult& result)
+{
+  stringstream stream;
+  stream << result.is_nat_present << '\t' << result.is_firewall_present << '\t' << result.timestamp << '\t'
+    << result.public_ip << '\t' << result.nat_type;
+
+  return stream.str();
+}
+
+bool parse_result(const string& line, NatDetectionResult& result)
+{
+  vector<string> fields;
+  size_t begin = 0;
+  for (size_t end = line.find('\t'); string::npos != end; begin = end + 1, end = line.find('\t', begin))
+    fields.push_back(line.substr(begin, end - begin));
+  fields.push_back(line.substr(begin));
+
+  if (fields.size() != 5)
+    return false;
+
+  result.is_nat_present = "1" == fields[0];
+  result.is_firewall_present = "1" == fields[1];
+  result.timestamp = strtoll(fields[2].c_str(), nullptr, 10);
+  result.public_ip = fields[3];
+  result.nat_type = fields[4];
+
+  return true;
+}
+
+
+/****************************** NatTypeDetector *******************************/
+
+
+NatTypeDetector::NatTypeDetector() : controller_(&StunController::instance())
+{}
+
+NatTypeDetector::NatTypeDetector(StunController& controller) : controller_(&controller)
+{}
+
 StunMessage NatTypeDetector::make_request(const StunMessage& request) const
 {
   int rto = rto_;
-  StunController& stun_controller = StunController::instance();
   StunMessage response;
 
+  TRACE_TRANSACTION_START(request.get_transaction_id(), request.get_server().c_str(), request.get_port());
+
   for (size_t i = 0; i < attempts_number_; ++i)
   {
-    stun_controller.send_message(request);
-    if (stun_controller.recieve_message(response, request.get_transaction_id()))
+    controller_->send_message(request);
+    if (controller_->recieve_message(response, request.get_transaction_id()))
       break;
 
     this_thread::sleep_for(chrono::milliseconds(rto));
@@ -35,12 +99,32 @@ StunMessage NatTypeDetector::make_request(const StunMessage& request) const
   return response;
 }
 
-bool NatTypeDetector::test_1(const string& server)
+StunMessage NatTypeDetector::make_test_1_request(const string& server) const
 {
   StunMessage request(server, DEFAULT_PORT, StunMessageType::BindingRequest);
   request.add_string_attribute(StunAttributeType::Software, "HELLo");
 
-  StunMessage response = make_request(request);
+  return request;
+}
+
+StunMessage NatTypeDetector::make_test_2_request(const string& server) const
+{
+  StunMessage request(server, DEFAULT_PORT, StunMessageType::BindingRequest);
+  request.add_int_attribute(StunAttributeType::ChangeAddress, 6);
+
+  return request;
+}
+
+StunMessage NatTypeDetector::make_test_3_request(const string& server) const
+{
+  StunMessage request(server, DEFAULT_PORT, StunMessageType::BindingRequest);
+  request.add_int_attribute(StunAttributeType::ChangeAddress, 2);
+
+  return request;
+}
+
+void NatTypeDetector::process_test_1_response(const string& server, const StunMessage& response)
+{
   if (StunMessageType::Unknown == response.get_type())
   {
     stringstream stream;
@@ -48,120 +132,268 @@ bool NatTypeDetector::test_1(const string& server)
     throw Exception(stream.str());
   }
 
-  auto attribute = response.get_attribute(StunAttributeType::XorMappedAddress1);
-  if (nullptr == attribute)
-    attribute = response.get_attribute(StunAttributeType::XorMappedAddress2);
-
-  if (nullptr != attribute)
-  {
-    StunXorMappedAddressAdapter mapped_ip_address(attribute);
-    ip_address_from_test1_ = mapped_ip_address.get_address(response.get_transaction_id());
+  size_t port;
+  if (response.get_mapped_address(ip_address_from_test1_, port))
     is_nat_present_ = !is_public_address(ip_address_from_test1_);
-  }
+}
+
+bool NatTypeDetector::is_public_address(const string& address) const
+{
+  if (local_addresses_)
+    return local_addresses_->find(address) != end(*local_addresses_);
+
+  LocalAddressTable& local_addresses = LocalAddressTable::instance();
+  local_addresses.update();
+
+  return local_addresses.contains(address);
+}
+
+void NatTypeDetector::process_blocking_response(const StunMessage& response)
+{
+  if (Stage::Test1 == stage_ && StunMessageType::Unknown == response.get_type() && nullptr != tcp_controller_)
+    detect_over_tcp();
+  else
+    process_response(response);
+}
+
+void NatTypeDetector::detect_over_tcp()
+{
+  // Test 1 requests to both servers go out without waiting for responses,
+  // pipelined over one connection if the servers are the same.
+  StunMessage request1 = make_test_1_request(server1_);
+  StunMessage request2 = make_test_1_request(server2_);
+  TRACE_TRANSACTION_START(request1.get_transaction_id(), server1_.c_str(), request1.get_port());
+  TRACE_TRANSACTION_START(request2.get_transaction_id(), server2_.c_str(), request2.get_port());
+
+  if (server1_ == server2_)
+    tcp_controller_->send_messages({ request1, request2 });
   else
   {
-    auto attribute = response.get_attribute(StunAttributeType::MappedAddress);
-    if (nullptr != attribute)
+    tcp_controller_->send_message(request1);
+    try
     {
-      StunMappedAddressAdapter mapped_ip_address(attribute);
-      ip_address_from_test1_ = mapped_ip_address.get_address();
-      is_nat_present_ = !is_public_address(ip_address_from_test1_);
+      tcp_controller_->send_message(request2);
+    }
+    catch (const Exception&)
+    {
+      // Mapped address from server2 is optional.
     }
   }
 
-  return true;
-}
+  StunMessage response;
+  tcp_controller_->recieve_message(response, request1.get_transaction_id());
 
-bool NatTypeDetector::test_2(const string& server)
-{
-  StunMessage request(server, DEFAULT_PORT, StunMessageType::BindingRequest);
-  request.add_int_attribute(StunAttributeType::ChangeAddress, 6);
+  if (StunMessageType::Unknown == response.get_type() ||
+      !response.get_mapped_address(ip_address_from_test1_, tcp_mapped_port_))
+  {
+    stringstream stream;
+    stream << "UDP and TCP are blocked or check access to " << server1_ << " server";
+    throw Exception(stream.str());
+  }
 
-  StunMessage response = make_request(request);
-  if (StunMessageType::Unknown == response.get_type())
-    return false;
+  // The response of server2 is usually read together with the one of server1, it isn't waited for long.
+  StunMessage response2;
+  if (!tcp_controller_->recieve_message(response2, request2.get_transaction_id(), tcp_server2_timeout_) ||
+      !response2.get_mapped_address(tcp_mapped_address2_, tcp_mapped_port2_))
+  {
+    tcp_mapped_address2_.clear();
+    tcp_mapped_port2_ = 0;
+  }
 
-  return true;
+  // TCP mappings and filtering say nothing about the UDP NAT type, only the mapped address is reported.
+  is_nat_present_ = !is_public_address(ip_address_from_test1_);
+  is_firewall_present_ = true;
+  nat_type_ = "UDP blocked";
+  is_udp_blocked_ = true;
+
+  finish();
 }
 
-bool NatTypeDetector::test_3(const string& server)
+void NatTypeDetector::execute(const string& server1, const string& server2)
 {
-  StunMessage request(server, DEFAULT_PORT, StunMessageType::BindingRequest);
-  request.add_int_attribute(StunAttributeType::ChangeAddress, 2);
+  start(server1, server2);
 
-  StunMessage response = make_request(request);
-  if (StunMessageType::Unknown == response.get_type())
-    return false;
-
-  return true;
+  while (!is_finished())
+    process_blocking_response(make_request(request_));
 }
 
-bool NatTypeDetector::is_public_address(const string& address) const
+void NatTypeDetector::execute(const string& server1, const string& server2, const ResultCache& cache)
 {
-  int s = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  string fingerprint = ResultCache::make_network_fingerprint();
 
-  struct sockaddr_in ip_address;
-  if (1 != inet_pton(AF_INET, address.c_str(), &ip_address.sin_addr))
+  NatDetectionResult cached_result;
+  bool is_found = cache.find(fingerprint, cached_result);
+
+  start(server1, server2);
+  process_blocking_response(make_request(request_));
+
+  if (is_found && !is_finished() && cached_result.public_ip == ip_address_from_test1_)
   {
-    cerr << "Failed to create sockaddr_in structure from IP address: " << address << endl;
+    is_nat_present_ = cached_result.is_nat_present;
+    is_firewall_present_ = cached_result.is_firewall_present;
+    nat_type_ = cached_result.nat_type;
+    timestamp_ = cached_result.timestamp;
+    is_cached_ = true;
+    stage_ = Stage::Finished;
+    TRACE_VERDICT(is_nat_present_, is_firewall_present_, nat_type_.c_str(), ip_address_from_test1_.c_str());
 
-    return false;
+    return;
   }
 
-  struct sockaddr_in local_address;
-  memset(&local_address, 0, sizeof(local_address));
-  local_address.sin_family = AF_INET;
-  local_address.sin_port = htons(0);
-  local_address.sin_addr.s_addr = ip_address.sin_addr.s_addr;
+  while (!is_finished())
+    process_blocking_response(make_request(request_));
 
-  bool is_public_address = false;
-  if (bind(s, (struct sockaddr *) &local_address, sizeof(local_address)) == 0)
-    is_public_address = true;
+  // Result over TCP isn't comparable with UDP results cached for the network.
+  if (!is_udp_blocked_)
+    cache.store(fingerprint, get_result());
+}
 
-  close(s);
+void NatTypeDetector::start(const string& server1, const string& server2)
+{
+  server1_ = server1;
+  server2_ = server2;
+
+  is_nat_present_ = false;
+  is_firewall_present_ = false;
+  nat_type_.clear();
+  ip_address_from_test1_.clear();
+  previous_ip_address_.clear();
+  timestamp_ = 0;
+  is_cached_ = false;
+  is_udp_blocked_ = false;
+  tcp_mapped_port_ = 0;
+  tcp_mapped_address2_.clear();
+  tcp_mapped_port2_ = 0;
 
-  return is_public_address;
+  stage_ = Stage::Test1;
+  request_ = make_test_1_request(server1_);
 }
 
-void NatTypeDetector::execute(const string& server1, const string& server2)
+void NatTypeDetector::process_response(const StunMessage& response)
 {
-  if (!test_1(server1))
-    return;
+  bool is_responded = StunMessageType::Unknown != response.get_type();
 
-  if (is_nat_present_)
+  switch (stage_)
   {
-    if (!test_2(server1))
-    {
-      string previous_public_ip_address = ip_address_from_test1_;
-      if (test_1(server2))
+    case Stage::Test1:
+      process_test_1_response(server1_, response);
+
+      stage_ = Stage::Test2;
+      request_ = make_test_2_request(server1_);
+      break;
+
+    case Stage::Test2:
+      if (!is_nat_present_)
+      {
+        is_firewall_present_ = !is_responded;
+        finish();
+      }
+      else if (is_responded)
       {
-        if (previous_public_ip_address == ip_address_from_test1_)
-        {
-          if (test_3(server1))
-            nat_type_ = "Address-restricted-cone NAT";
-          else
-            nat_type_ = "Port-restricted-cone NAT";
-        }
-        else
-          nat_type_ = "Symmetric NAT";
+        nat_type_ = "Full-cone NAT";
+        finish();
       }
       else
-        cout << "Failed to run test 1 for server 2" << endl;
-    }
-    else
-      nat_type_ = "Full-cone NAT";
+      {
+        previous_ip_address_ = ip_address_from_test1_;
+        stage_ = Stage::Test1Server2;
+        request_ = make_test_1_request(server2_);
+      }
+      break;
+
+    case Stage::Test1Server2:
+      process_test_1_response(server2_, response);
+
+      if (previous_ip_address_ == ip_address_from_test1_)
+      {
+        stage_ = Stage::Test3;
+        request_ = make_test_3_request(server1_);
+      }
+      else
+      {
+        nat_type_ = "Symmetric NAT";
+        finish();
+      }
+      break;
+
+    case Stage::Test3:
+      nat_type_ = is_responded ? "Address-restricted-cone NAT" : "Port-restricted-cone NAT";
+      finish();
+      break;
+
+    case Stage::Finished:
+      break;
   }
-  else
-    is_firewall_present_ = !test_2(server1);
+}
+
+void NatTypeDetector::finish()
+{
+  stage_ = Stage::Finished;
+  timestamp_ = time(nullptr);
+  TRACE_VERDICT(is_nat_present_, is_firewall_present_, nat_type_.c_str(), ip_address_from_test1_.c_str());
+}
+
+bool NatTypeDetector::is_finished() const
+{
+  return Stage::Finished == stage_;
+}
+
+const StunMessage& NatTypeDetector::get_request() const
+{
+  return request_;
+}
+
+NatDetectionResult NatTypeDetector::get_result() const
+{
+  NatDetectionResult result;
+  result.is_nat_present = is_nat_present_;
+  result.is_firewall_present = is_firewall_present_;
+  result.nat_type = nat_type_;
+  result.public_ip = ip_address_from_test1_;
+  result.timestamp = timestamp_;
+
+  return result;
+}
+
+StunController& NatTypeDetector::get_controller() const
+{
+  return *controller_;
+}
+
+void NatTypeDetector::set_tcp_fallback(StunTcpController* controller)
+{
+  tcp_controller_ = controller;
+}
+
+void NatTypeDetector::set_local_addresses(const unordered_set<string>& addresses)
+{
+  local_addresses_ = addresses;
+}
+
+size_t NatTypeDetector::get_attempts_number()
+{
+  return attempts_number_;
+}
+
+size_t NatTypeDetector::get_rto()
+{
+  return rto_;
 }
 
 void NatTypeDetector::print_result() const
 {
-  cout << "NAT detected: " << (is_nat_present_ ? "YES" : "NO") << endl;
-  if (is_nat_present_)
-    cout << "NAT type: " << nat_type_ << endl;
-  else
-    cout << (is_firewall_present_ ? "Symmetric Firewall" : "Open Internet") << endl;
+  if (is_udp_blocked_)
+  {
+    cout << "UDP blocked" << endl;
+    cout << "NAT detected: " << (is_nat_present_ ? "YES" : "NO") << endl;
+    cout << "TCP mapped address: " << ip_address_from_test1_ << ":" << tcp_mapped_port_ << endl;
+    if (server1_ != server2_ && !tcp_mapped_address2_.empty())
+      cout << "TCP mapped address from server2: " << tcp_mapped_address2_ << ":" << tcp_mapped_port2_ << endl;
+
+    return;
+  }
 
-  cout << "Public IP: " << ip_address_from_test1_ << endl;
+  ::print_result(get_result());
+  if (is_cached_)
+    cout << "Cached result from: " << put_time(localtime(&timestamp_), "%F %T") << endl;
 }
@@ -2,35 +2,119 @@
 #define NAT_TYPE_DETECTOR_H
 
 #include <cstddef>
+#include <ctime>
+#include <optional>
 #include <string>
+#include <unordered_set>
 
+#include "StunMessage.h"
 
-class StunMessage;
 
+class StunController;
+class StunTcpController;
+class ResultCache;
+
+
+struct NatDetectionResult
+{
+  bool is_nat_present = false;
+  bool is_firewall_present = false;
+  std::string nat_type;
+  std::string public_ip;
+  std::time_t timestamp = 0;
+};
+
+// Verdict, its type and public IP address joined by separator.
+std::string format_result(const NatDetectionResult& result, const std::string& separator);
+void print_result(const NatDetectionResult& result);
+// Tab-separated single line form used by the result cache and the daemon.
+std::string serialize_result(const NatDetectionResult& result);
+bool parse_result(const std::string& line, NatDetectionResult& result);
 
 class NatTypeDetector
 {
 public:
+  NatTypeDetector();
+  explicit NatTypeDetector(StunController& controller);
+
   void execute(const std::string& server1, const std::string& server2);
+  // Validates result cached for the current network with a single test 1 and
+  // runs the full detection only if nothing is cached or the mapped address has changed.
+  void execute(const std::string& server1, const std::string& server2, const ResultCache& cache);
   void print_result() const;
 
+  // Step-by-step interface: start() prepares the first request, every response
+  // (or StunMessageType::Unknown on timeout) passed to process_response()
+  // either prepares the next request or finishes detection.
+  void start(const std::string& server1, const std::string& server2);
+  void process_response(const StunMessage& response);
+  bool is_finished() const;
+  const StunMessage& get_request() const;
+
+  NatDetectionResult get_result() const;
+  StunController& get_controller() const;
+
+  // If test 1 gets no response over UDP, execute() repeats it over TCP to
+  // both servers at once and reports that UDP is blocked and the TCP mapped
+  // addresses instead of failing. Such a result isn't cached. Not used by the
+  // step-by-step interface.
+  void set_tcp_fallback(StunTcpController* controller);
+
+  // Mapped addresses are compared with these instead of current addresses of
+  // local interfaces, used to replay a detection recorded on another host.
+  void set_local_addresses(const std::unordered_set<std::string>& addresses);
+
+  static size_t get_attempts_number();
+  static size_t get_rto();
+
 private:
-  bool test_1(const std::string& server);
-  bool test_2(const std::string& server);
-  bool test_3(const std::string& server);
+  enum class Stage
+  {
+    Test1,
+    Test2,
+    Test1Server2,
+    Test3,
+    Finished
+  };
+
+  void finish();
+  void process_test_1_response(const std::string& server, const StunMessage& response);
+
+  StunMessage make_test_1_request(const std::string& server) const;
+  StunMessage make_test_2_request(const std::string& server) const;
+  StunMessage make_test_3_request(const std::string& server) const;
 
   StunMessage make_request(const StunMessage& message) const;
+  void process_blocking_response(const StunMessage& response);
+  void detect_over_tcp();
 
   bool is_public_address(const std::string& address) const;
 
 private:
   static const size_t attempts_number_ = 7;
   static const size_t rto_ = 500;
+  static const size_t tcp_server2_timeout_ = 1000;
+
+  StunController* controller_;
+  StunTcpController* tcp_controller_ = nullptr;
+
+  Stage stage_ = Stage::Finished;
+  std::string server1_;
+  std::string server2_;
+  StunMessage request_;
 
   bool is_nat_present_ = false;
   bool is_firewall_present_ = false;
   std::string nat_type_;
   std::string ip_address_from_test1_;
+  std::string previous_ip_address_;
+  std::time_t timestamp_ = 0;
+  bool is_cached_ = false;
+  bool is_udp_blocked_ = false;
+  size_t tcp_mapped_port_ = 0;
+  std::string tcp_mapped_address2_;
+  size_t tcp_mapped_port2_ = 0;
+  std::optional<std::unordered_set<std::string>> local_addresses_;
 };
 
 #endif
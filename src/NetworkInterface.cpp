@@ -0,0 +1,40 @@
+#include "NetworkInterface.h"
+
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "Exception.h"
+
+
+using namespace std;
+
+
+vector<NetworkInterface> get_network_interfaces()
+{
+  struct ifaddrs* addresses;
+  if (-1 == getifaddrs(&addresses))
+    throw Exception("Failed to get addresses of network interfaces.");
+
+  vector<NetworkInterface> interfaces;
+  for (auto address = addresses; nullptr != address; address = address->ifa_next)
+  {
+    if (nullptr == address->ifa_addr || AF_INET != address->ifa_addr->sa_family)
+      continue;
+
+    if (0 == (address->ifa_flags & IFF_UP) || 0 != (address->ifa_flags & IFF_LOOPBACK))
+      continue;
+
+    char ip[INET_ADDRSTRLEN];
+    auto ip_address = reinterpret_cast<struct sockaddr_in*>(address->ifa_addr);
+    if (nullptr == inet_ntop(AF_INET, &ip_address->sin_addr, ip, INET_ADDRSTRLEN))
+      continue;
+
+    interfaces.push_back(NetworkInterface { address->ifa_name, ip });
+  }
+
+  freeifaddrs(addresses);
+
+  return interfaces;
+}
@@ -0,0 +1,17 @@
+#ifndef NETWORK_INTERFACE_H
+#define NETWORK_INTERFACE_H
+
+#include <string>
+#include <vector>
+
+
+struct NetworkInterface
+{
+  std::string name;
+  std::string address;
+};
+
+// Returns IPv4 addresses of all up, non-loopback interfaces.
+std::vector<NetworkInterface> get_network_interfaces();
+
+#endif /* end of include guard: NETWORK_INTERFACE_H */
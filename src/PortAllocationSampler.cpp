@@ -0,0 +1,271 @@
+#include "PortAllocationSampler.h"
+
+#include <poll.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "Exception.h"
+#include "NatTypeDetector.h"
+#include "StunMessageArena.h"
+#include "StunTransactionLoop.h"
+
+
+using namespace std;
+
+
+PortAllocationSampler::PortAllocationSampler(size_t sockets_number) : sockets_number_(sockets_number)
+{}
+
+void PortAllocationSampler::execute(const string& server)
+{
+  discover_destinations(server);
+
+  controllers_.clear();
+  requests_.clear();
+  samples_.clear();
+  sample_indexes_.clear();
+
+  for (size_t i = 0; i < sockets_number_; ++i)
+  {
+    controllers_.push_back(make_unique<StunController>());
+    controllers_.back()->enable_timestamps();
+
+    requests_.emplace_back();
+    for (auto& destination : destinations_)
+    {
+      requests_.back().emplace_back(destination.first, destination.second, StunMessageType::BindingRequest);
+      sample_indexes_[requests_.back().back().get_transaction_id()] = samples_.size();
+      samples_.push_back(Sample { i, 0, 0, timespec {}, timespec {}, false, false });
+    }
+  }
+
+  send_burst();
+  collect_responses();
+  fit_model();
+}
+
+void PortAllocationSampler::discover_destinations(const string& server)
+{
+  StunController controller;
+  StunMessage request(server, DEFAULT_PORT, StunMessageType::BindingRequest);
+
+  StunMessage response;
+  StunTransactionLoop loop;
+  loop.add_transaction(controller, request, [&response](const StunMessage& message) { response = message; },
+      NatTypeDetector::get_attempts_number(), NatTypeDetector::get_rto());
+  loop.run();
+
+  if (StunMessageType::BindingSuccessResponse != response.get_type())
+  {
+    stringstream stream;
+    stream << "UDP is blocked or check access to " << server << " server";
+    throw Exception(stream.str());
+  }
+
+  // Numeric addresses keep name resolution out of the burst.
+  destinations_.clear();
+  destinations_.emplace_back(response.get_server(), response.get_port());
+
+  auto attribute = response.get_attribute(StunAttributeType::OtherAddress);
+  if (nullptr == attribute)
+    attribute = response.get_attribute(StunAttributeType::ChangedAddress);
+
+  if (nullptr != attribute)
+  {
+    StunMappedAddressAdapter other_address(attribute);
+    destinations_.emplace_back(response.get_server(), other_address.get_port());
+    destinations_.emplace_back(other_address.get_address(), response.get_port());
+    destinations_.emplace_back(other_address.get_address(), other_address.get_port());
+  }
+}
+
+void PortAllocationSampler::send_burst()
+{
+  for (size_t i = 0; i < controllers_.size(); ++i)
+  {
+    timespec send_time;
+    clock_gettime(CLOCK_REALTIME, &send_time);
+
+    size_t sent_number = controllers_[i]->send_messages(requests_[i]);
+    for (size_t j = 0; j < sent_number; ++j)
+    {
+      auto& sample = samples_[sample_indexes_[requests_[i][j].get_transaction_id()]];
+      sample.send_time = send_time;
+      sample.is_sent = true;
+    }
+  }
+
+  // Unbound sockets get their ports with the first datagram.
+  for (auto& sample : samples_)
+    sample.local_port = controllers_[sample.socket_index]->get_local_port();
+}
+
+void PortAllocationSampler::collect_responses()
+{
+  vector<pollfd> descriptors;
+  for (auto& controller : controllers_)
+    descriptors.push_back(pollfd { controller->get_socket(), POLLIN, 0 });
+
+  received_number_ = 0;
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(response_timeout_);
+  while (received_number_ < samples_.size())
+  {
+    auto now = chrono::steady_clock::now();
+    if (now >= deadline)
+      break;
+
+    int timeout = chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1;
+    if (poll(descriptors.data(), descriptors.size(), timeout) <= 0)
+      continue;
+
+    StunMessageArena::Batch batch;
+    for (size_t i = 0; i < descriptors.size(); ++i)
+    {
+      if (0 == (descriptors[i].revents & POLLIN))
+        continue;
+
+      StunMessage response(batch.get_resource());
+      timespec receive_time;
+      while (controllers_[i]->read_message(response, receive_time))
+      {
+        auto found = sample_indexes_.find(response.get_transaction_id());
+        if (end(sample_indexes_) == found || StunMessageType::BindingSuccessResponse != response.get_type())
+          continue;
+
+        auto& sample = samples_[found->second];
+        string address;
+        if (sample.is_received || !response.get_mapped_address(address, sample.mapped_port))
+          continue;
+
+        sample.receive_time = receive_time;
+        sample.is_received = true;
+        ++received_number_;
+      }
+    }
+  }
+
+  if (0 == received_number_)
+    throw Exception("No responses to the burst were received.");
+}
+
+void PortAllocationSampler::fit_model()
+{
+  vector<const Sample*> received;
+  vector<double> rtts;
+  for (auto& sample : samples_)
+  {
+    if (!sample.is_received)
+      continue;
+
+    received.push_back(&sample);
+    rtts.push_back(get_microseconds(sample.send_time, sample.receive_time));
+  }
+
+  // sendmmsg may send only a part of a batch, unsent samples have no send time.
+  auto is_sent = [](const Sample& sample) { return sample.is_sent; };
+  auto first_sent = find_if(begin(samples_), end(samples_), is_sent);
+  auto last_sent = find_if(rbegin(samples_), rend(samples_), is_sent);
+  burst_duration_ = get_microseconds(first_sent->send_time, last_sent->send_time);
+  sort(begin(rtts), end(rtts));
+  median_rtt_ = rtts[rtts.size() / 2];
+
+  // A socket sending to an address it already has a mapping for may reuse it,
+  // only new allocations describe the allocator.
+  vector<const Sample*> allocations;
+  for (auto sample : received)
+  {
+    bool is_reused = any_of(begin(allocations), end(allocations), [sample](const Sample* allocation)
+        {
+          return allocation->socket_index == sample->socket_index && allocation->mapped_port == sample->mapped_port;
+        });
+
+    if (!is_reused)
+      allocations.push_back(sample);
+  }
+  allocations_number_ = allocations.size();
+
+  bool is_port_preserved = all_of(begin(allocations), end(allocations),
+      [](const Sample* sample) { return sample->mapped_port == sample->local_port; });
+  if (is_port_preserved)
+  {
+    model_ = "Port preservation";
+    exact_score_ = tolerant_score_ = 1;
+    return;
+  }
+
+  if (allocations.size() < 3)
+  {
+    model_ = "Unknown, too few samples";
+    return;
+  }
+
+  vector<int> deltas;
+  map<int, size_t> delta_counts;
+  for (size_t i = 1; i < allocations.size(); ++i)
+  {
+    deltas.push_back(get_port_delta(allocations[i - 1]->mapped_port, allocations[i]->mapped_port));
+    ++delta_counts[deltas.back()];
+  }
+
+  auto most_common = max_element(begin(delta_counts), end(delta_counts),
+      [](const pair<const int, size_t>& left, const pair<const int, size_t>& right)
+      {
+        return left.second < right.second;
+      });
+  delta_ = most_common->first;
+
+  size_t tolerant_number = count_if(begin(deltas), end(deltas),
+      [this](int delta) { return abs(delta - delta_) <= delta_tolerance_; });
+
+  exact_score_ = static_cast<double>(most_common->second) / deltas.size();
+  tolerant_score_ = static_cast<double>(tolerant_number) / deltas.size();
+
+  if (tolerant_score_ < 0.5 || 0 == delta_)
+  {
+    model_ = "Random";
+    return;
+  }
+
+  model_ = 1 == delta_ ? "Sequential" : "Delta";
+  next_port_ = (allocations.back()->mapped_port + 65536 + delta_) % 65536;
+}
+
+int PortAllocationSampler::get_port_delta(size_t previous_port, size_t port)
+{
+  int delta = static_cast<int>(port) - static_cast<int>(previous_port);
+  if (delta > 32767)
+    delta -= 65536;
+  else if (delta < -32768)
+    delta += 65536;
+
+  return delta;
+}
+
+double PortAllocationSampler::get_microseconds(const timespec& begin, const timespec& end)
+{
+  return (end.tv_sec - begin.tv_sec) * 1e6 + (end.tv_nsec - begin.tv_nsec) / 1e3;
+}
+
+void PortAllocationSampler::print_result() const
+{
+  auto flags = cout.flags();
+  auto precision = cout.precision();
+  cout << fixed << setprecision(2);
+  cout << "Samples: " << received_number_ << " of " << samples_.size() << " received, "
+    << allocations_number_ << " allocations" << endl;
+  cout << "Burst duration: " << burst_duration_ << " us, median RTT: " << median_rtt_ << " us" << endl;
+  cout << "Allocation: " << model_;
+  if ("Sequential" == model_ || "Delta" == model_ || "Random" == model_)
+    cout << " (most common delta " << delta_ << ")";
+  cout << endl;
+  cout << "Prediction score: " << exact_score_ << " exact, " << tolerant_score_ << " within +-" << delta_tolerance_
+    << endl;
+  if (0 != next_port_)
+    cout << "Predicted next port: " << next_port_ << endl;
+
+  cout.flags(flags);
+  cout.precision(precision);
+}
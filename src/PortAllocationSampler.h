@@ -0,0 +1,73 @@
+#ifndef PORT_ALLOCATION_SAMPLER_H
+#define PORT_ALLOCATION_SAMPLER_H
+
+#include <cstddef>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "StunController.h"
+
+
+// Samples how NAT allocates ports for new mappings. All sockets are opened and
+// all requests are encoded up front, then every socket sends its requests to
+// all server addresses (primary and, if OTHER-ADDRESS is known, alternate ones)
+// with a single sendmmsg, so the whole burst takes a fraction of a millisecond
+// and other traffic through the NAT hardly gets between samples. Mapped ports
+// ordered by send time are fitted to a sequential, delta or random model.
+class PortAllocationSampler
+{
+public:
+  explicit PortAllocationSampler(size_t sockets_number);
+
+  void execute(const std::string& server);
+  void print_result() const;
+
+private:
+  struct Sample
+  {
+    size_t socket_index;
+    size_t local_port;
+    size_t mapped_port;
+    timespec send_time;
+    timespec receive_time;
+    bool is_sent;
+    bool is_received;
+  };
+
+  void discover_destinations(const std::string& server);
+  void send_burst();
+  void collect_responses();
+  void fit_model();
+
+  static int get_port_delta(size_t previous_port, size_t port);
+  static double get_microseconds(const timespec& begin, const timespec& end);
+
+private:
+  static constexpr size_t response_timeout_ = 2000;
+  static constexpr int delta_tolerance_ = 4;
+
+  size_t sockets_number_;
+
+  std::vector<std::pair<std::string, size_t>> destinations_;
+  std::vector<std::unique_ptr<StunController>> controllers_;
+  std::vector<std::vector<StunMessage>> requests_;
+
+  std::vector<Sample> samples_;
+  std::map<TransactionId, size_t> sample_indexes_;
+
+  std::string model_;
+  int delta_ = 0;
+  double exact_score_ = 0;
+  double tolerant_score_ = 0;
+  size_t next_port_ = 0;
+  size_t received_number_ = 0;
+  size_t allocations_number_ = 0;
+  double burst_duration_ = 0;
+  double median_rtt_ = 0;
+};
+
+#endif /* end of include guard: PORT_ALLOCATION_SAMPLER_H */
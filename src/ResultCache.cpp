@@ -0,0 +1,209 @@
+#include "ResultCache.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "NetworkInterface.h"
+
+
+using namespace std;
+
+
+namespace
+{
+
+const char* const CACHE_DIRECTORY = "nat_type_detector";
+const char* const CACHE_FILE = "results";
+
+bool parse_line(const string& line, string& fingerprint, NatDetectionResult& result)
+{
+  size_t position = line.find('\t');
+  if (string::npos == position)
+    return false;
+
+  fingerprint = line.substr(0, position);
+
+  return parse_result(line.substr(position + 1), result);
+}
+
+string make_line(const string& fingerprint, const NatDetectionResult& result)
+{
+  return fingerprint + '\t' + serialize_result(result);
+}
+
+void make_directories(const string& path)
+{
+  for (size_t position = path.find('/', 1); string::npos != position; position = path.find('/', position + 1))
+    mkdir(path.substr(0, position).c_str(), 0755);
+}
+
+// Returns interface, address and MAC of default IPv4 gateway.
+string get_default_gateway()
+{
+  ifstream routes("/proc/net/route");
+  string line;
+  getline(routes, line);
+
+  string gateway_interface;
+  struct in_addr gateway_address;
+  gateway_address.s_addr = 0;
+  while (getline(routes, line))
+  {
+    stringstream stream(line);
+    string name, destination, gateway;
+    stream >> name >> destination >> gateway;
+    if ("00000000" != destination)
+      continue;
+
+    gateway_interface = name;
+    // Addresses are printed as raw network-order words in host byte order.
+    gateway_address.s_addr = static_cast<in_addr_t>(strtoul(gateway.c_str(), nullptr, 16));
+    break;
+  }
+
+  if (gateway_interface.empty())
+    return "none";
+
+  char ip[INET_ADDRSTRLEN];
+  string address = inet_ntop(AF_INET, &gateway_address, ip, INET_ADDRSTRLEN);
+
+  string mac = "unknown";
+  ifstream neighbours("/proc/net/arp");
+  getline(neighbours, line);
+  while (getline(neighbours, line))
+  {
+    stringstream stream(line);
+    string neighbour_address, type, flags, neighbour_mac, mask, device;
+    stream >> neighbour_address >> type >> flags >> neighbour_mac >> mask >> device;
+    if (neighbour_address == address && device == gateway_interface)
+    {
+      mac = neighbour_mac;
+      break;
+    }
+  }
+
+  return gateway_interface + "/" + address + "/" + mac;
+}
+
+}
+
+
+ResultCache::ResultCache(const string& path) : path_(path)
+{}
+
+bool ResultCache::find(const string& fingerprint, NatDetectionResult& result) const
+{
+  ifstream file(path_);
+  string line;
+  while (getline(file, line))
+  {
+    string line_fingerprint;
+    NatDetectionResult line_result;
+    if (parse_line(line, line_fingerprint, line_result) && line_fingerprint == fingerprint)
+    {
+      result = line_result;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ResultCache::store(const string& fingerprint, const NatDetectionResult& result) const
+{
+  vector<string> lines;
+  {
+    ifstream file(path_);
+    string line;
+    while (getline(file, line))
+    {
+      string line_fingerprint;
+      NatDetectionResult line_result;
+      if (parse_line(line, line_fingerprint, line_result) && line_fingerprint != fingerprint)
+        lines.push_back(line);
+    }
+  }
+  lines.push_back(make_line(fingerprint, result));
+
+  make_directories(path_);
+
+  stringstream data;
+  for (auto& line : lines)
+    data << line << '\n';
+  string content = data.str();
+
+  // Written to a unique temporary file and renamed, so readers never see a partial file
+  // and concurrent writers don't overwrite each other's temporary file.
+  string temporary_path = path_ + ".XXXXXX";
+  int file = mkstemp(temporary_path.data());
+  if (-1 == file)
+  {
+    cerr << "Failed to write result cache: " << temporary_path << ". Error: " << strerror(errno) << endl;
+    return;
+  }
+
+  fchmod(file, 0644);
+  size_t offset = 0;
+  while (offset < content.size())
+  {
+    ssize_t size = write(file, content.data() + offset, content.size() - offset);
+    if (-1 == size && EINTR == errno)
+      continue;
+
+    if (-1 == size)
+    {
+      cerr << "Failed to write result cache: " << temporary_path << ". Error: " << strerror(errno) << endl;
+      close(file);
+      unlink(temporary_path.c_str());
+      return;
+    }
+    offset += size;
+  }
+  close(file);
+
+  if (0 != rename(temporary_path.c_str(), path_.c_str()))
+  {
+    cerr << "Failed to write result cache: " << path_ << ". Error: " << strerror(errno) << endl;
+    unlink(temporary_path.c_str());
+  }
+}
+
+string ResultCache::get_default_path()
+{
+  string directory;
+  if (const char* cache_home = getenv("XDG_CACHE_HOME"); nullptr != cache_home && '\0' != cache_home[0])
+    directory = cache_home;
+  else if (const char* home = getenv("HOME"); nullptr != home && '\0' != home[0])
+    directory = string(home) + "/.cache";
+  else
+    directory = "/tmp";
+
+  return directory + "/" + CACHE_DIRECTORY + "/" + CACHE_FILE;
+}
+
+string ResultCache::make_network_fingerprint()
+{
+  auto interfaces = get_network_interfaces();
+  sort(begin(interfaces), end(interfaces), [](const NetworkInterface& left, const NetworkInterface& right)
+      {
+        return left.name != right.name ? left.name < right.name : left.address < right.address;
+      });
+
+  stringstream stream;
+  stream << "gateway=" << get_default_gateway() << ";interfaces=";
+  for (auto& network_interface : interfaces)
+    stream << network_interface.name << "/" << network_interface.address << ",";
+
+  return stream.str();
+}
@@ -0,0 +1,27 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <string>
+
+#include "NatTypeDetector.h"
+
+
+// Persistent storage of detection results keyed by network fingerprint:
+// default gateway address and MAC plus addresses of local interfaces. Every
+// known network keeps its own line in the cache file.
+class ResultCache
+{
+public:
+  explicit ResultCache(const std::string& path = get_default_path());
+
+  bool find(const std::string& fingerprint, NatDetectionResult& result) const;
+  void store(const std::string& fingerprint, const NatDetectionResult& result) const;
+
+  static std::string get_default_path();
+  static std::string make_network_fingerprint();
+
+private:
+  std::string path_;
+};
+
+#endif /* end of include guard: RESULT_CACHE_H */
@@ -37,22 +37,32 @@ bool is_supported_required_attribute(uint16_t attribute)
 
 /****************************** StunAttribute *********************************/
 
-StunAttribute::StunAttribute(const StunAttributeHeader& header)
+StunAttribute::StunAttribute(const StunAttributeHeader& header, const allocator_type& allocator) :
+  header_(header), value_(allocator)
 {
-  header_ = header;
 }
 
-StunAttribute::StunAttribute(const StunAttributeHeader& header, const std::vector<std::byte>& value)
+StunAttribute::StunAttribute(const StunAttributeHeader& header, const byte* value, size_t size,
+    const allocator_type& allocator) :
+  header_(header), value_(value, value + size, allocator)
 {
-  header_ = header;
-  value_ = value;
 }
 
-StunAttribute::StunAttribute(uint16_t type, uint16_t length, const std::vector<std::byte>& value)
+StunAttribute::StunAttribute(uint16_t type, const byte* value, size_t size, const allocator_type& allocator) :
+  value_(value, value + size, allocator)
 {
   header_.type = htons(type);
-  header_.length = htons(length);
-  value_ = value;
+  header_.length = htons(size);
+}
+
+StunAttribute::StunAttribute(const StunAttribute& attribute, const allocator_type& allocator) :
+  header_(attribute.header_), value_(attribute.value_, allocator)
+{
+}
+
+StunAttribute::StunAttribute(StunAttribute&& attribute, const allocator_type& allocator) :
+  header_(attribute.header_), value_(move(attribute.value_), allocator)
+{
 }
 
 const StunAttributeHeader& StunAttribute::get_header() const
@@ -70,11 +80,16 @@ uint16_t StunAttribute::get_length() const
   return ntohs(header_.length);
 }
 
-const vector<byte>& StunAttribute::get_value() const
+const pmr::vector<byte>& StunAttribute::get_value() const
 {
   return value_;
 }
 
+StunAttribute::allocator_type StunAttribute::get_allocator() const
+{
+  return value_.get_allocator();
+}
+
 
 /*********************** StunXorMappedAddressAttribute ************************/
 
@@ -5,6 +5,7 @@
 #include <cstddef>
 #include <string>
 #include <array>
+#include <memory_resource>
 #include <vector>
 
 
@@ -34,12 +35,15 @@ enum StunAttributeType : uint16_t
   Realm = 0x0014,
   Nonce = 0x0015,
   XorMappedAddress1 = 0x0020,
+  ResponsePort = 0x0027,
   XorMappedAddress2 = 0x8020,
 
   // Comprehension-optional attributes
   Software = 0x8022,
   AlternateServer = 0x8023,
-  Fingerprint = 0x8028
+  Fingerprint = 0x8028,
+  ResponseOrigin = 0x802B,
+  OtherAddress = 0x802C
 };
 
 bool is_comprehension_required_attribute(uint16_t attribute);
@@ -52,21 +56,32 @@ struct StunAttributeHeader
   uint16_t length;
 };
 
+// Value memory comes from the allocator, containers of attributes pass theirs on construction.
 class StunAttribute
 {
 public:
-  StunAttribute(const StunAttributeHeader& header);
-  StunAttribute(const StunAttributeHeader& header, const std::vector<std::byte>& value);
-  StunAttribute(uint16_t type, uint16_t length, const std::vector<std::byte>& value);
+  using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+  explicit StunAttribute(const StunAttributeHeader& header, const allocator_type& allocator = {});
+  StunAttribute(const StunAttributeHeader& header, const std::byte* value, size_t size,
+      const allocator_type& allocator = {});
+  StunAttribute(uint16_t type, const std::byte* value, size_t size, const allocator_type& allocator = {});
+  StunAttribute(const StunAttribute& attribute) = default;
+  StunAttribute(const StunAttribute& attribute, const allocator_type& allocator);
+  StunAttribute(StunAttribute&& attribute) = default;
+  StunAttribute(StunAttribute&& attribute, const allocator_type& allocator);
+  StunAttribute& operator=(const StunAttribute& attribute) = default;
+  StunAttribute& operator=(StunAttribute&& attribute) = default;
 
   const StunAttributeHeader& get_header() const;
   uint16_t get_type() const;
   uint16_t get_length() const;
-  const std::vector<std::byte>& get_value() const;
+  const std::pmr::vector<std::byte>& get_value() const;
+  allocator_type get_allocator() const;
 
 protected:
   StunAttributeHeader header_;
-  std::vector<std::byte> value_;
+  std::pmr::vector<std::byte> value_;
 };
 
 class StunMappedAddressAdapter
@@ -6,15 +6,34 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <cerrno>
 #include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
 #include "StunMessage.h"
 #include "Exception.h"
+#include "ExchangeLog.h"
+#include "Tracepoints.h"
 
 using namespace std;
 
+
+namespace
+{
+
+// Received datagrams are decoded right away, so one buffer per thread serves all sockets.
+vector<byte>& get_receive_buffer()
+{
+  thread_local vector<byte> buffer(65535, byte {0});
+
+  return buffer;
+}
+
+}
+
+
 StunController::StunController()
 {
   socket_ = socket(AF_INET, SOCK_DGRAM, 0);
@@ -25,6 +44,31 @@ StunController::StunController()
     throw Exception("Failed to set non-blocking mode for socket.");
 }
 
+StunController::StunController(const string& local_address, const string& device) : StunController()
+{
+  if (!device.empty() &&
+      -1 == setsockopt(socket_, SOL_SOCKET, SO_BINDTODEVICE, device.c_str(), device.size()))
+  {
+    stringstream stream;
+    stream << "Failed to bind socket to " << device << " device. Error: " << strerror(errno);
+    close(socket_);
+    throw Exception(stream.str());
+  }
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(0);
+  if (1 != inet_pton(AF_INET, local_address.c_str(), &address.sin_addr) ||
+      -1 == bind(socket_, (struct sockaddr *) &address, sizeof(address)))
+  {
+    stringstream stream;
+    stream << "Failed to bind socket to " << local_address << " address. Error: " << strerror(errno);
+    close(socket_);
+    throw Exception(stream.str());
+  }
+}
+
 StunController::~StunController()
 {
   if (socket_ != -1)
@@ -45,16 +89,25 @@ void StunController::send_message(const StunMessage& message) const
 
   for (auto ai = address_info; nullptr != ai; ai = ai->ai_next)
   {
-    if (-1 != sendto(socket_, data.data(), data.size(), 0, address_info->ai_addr, address_info->ai_addrlen))
+    if (-1 != sendto(socket_, data.data(), data.size(), 0, ai->ai_addr, ai->ai_addrlen))
+    {
+      TRACE_TRANSMIT(message.get_transaction_id(), socket_, data.size());
+      if (ExchangeRecorder::instance().is_open())
+        ExchangeRecorder::instance().record(ExchangeDirection::Sent, ExchangeTransport::Udp, get_local_port(),
+            *reinterpret_cast<sockaddr_in*>(ai->ai_addr), data.data(), data.size());
+
+      freeaddrinfo(address_info);
       return;
+    }
   }
 
+  freeaddrinfo(address_info);
   throw Exception("Failed to send message.");
 }
 
 bool StunController::recieve_message(StunMessage& message, const TransactionId& transaction_id) const
 {
-  vector<byte> buffer(65535, byte {0});
+  auto& buffer = get_receive_buffer();
 
   struct timeval time_out = {1, 0};
   fd_set readfds;
@@ -68,10 +121,18 @@ bool StunController::recieve_message(StunMessage& message, const TransactionId&
 
   if (result > 0 && FD_ISSET(socket_, &readfds))
   {
-    if (-1 == recvfrom(socket_, buffer.data(), buffer.size(), 0, nullptr, nullptr))
+    struct sockaddr_in source;
+    socklen_t source_length = sizeof(source);
+    ssize_t size = recvfrom(socket_, buffer.data(), buffer.size(), 0, (struct sockaddr *) &source, &source_length);
+    if (-1 == size)
       return false;
 
-    parse_data(buffer, message);
+    TRACE_RECEIVE(socket_, size, source.sin_addr.s_addr, source.sin_port, buffer.data());
+    if (ExchangeRecorder::instance().is_open())
+      ExchangeRecorder::instance().record(ExchangeDirection::Received, ExchangeTransport::Udp, get_local_port(),
+          source, buffer.data(), size);
+
+    message.set_data(buffer.data(), size);
 
     return validate_message(message, transaction_id);
   }
@@ -79,44 +140,140 @@ bool StunController::recieve_message(StunMessage& message, const TransactionId&
   return true;
 }
 
-void StunController::parse_data(const vector<byte>& data, StunMessage& message) const
+size_t StunController::send_messages(const vector<StunMessage>& messages) const
 {
-  size_t offset = 0;
-  StunMessageHeader header;
-  memcpy(&header, data.data(), sizeof(StunMessageHeader));
-  offset += sizeof(StunMessageHeader);
+  vector<vector<byte>> data;
+  vector<iovec> vectors(messages.size());
+  vector<mmsghdr> headers(messages.size());
+
+  data.reserve(messages.size());
+  for (size_t i = 0; i < messages.size(); ++i)
+  {
+    data.push_back(messages[i].get_data());
+    vectors[i].iov_base = data.back().data();
+    vectors[i].iov_len = data.back().size();
+
+    auto& address = resolve_server_address(messages[i].get_server(), messages[i].get_port());
+    memset(&headers[i], 0, sizeof(mmsghdr));
+    headers[i].msg_hdr.msg_name = const_cast<sockaddr_in*>(&address);
+    headers[i].msg_hdr.msg_namelen = sizeof(address);
+    headers[i].msg_hdr.msg_iov = &vectors[i];
+    headers[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  size_t sent_number = 0;
+  while (sent_number < headers.size())
+  {
+    int result = sendmmsg(socket_, headers.data() + sent_number, headers.size() - sent_number, 0);
+    if (-1 == result)
+    {
+      if (EINTR == errno)
+        continue;
 
-  uint16_t message_length = ntohs(header.length);
+      break;
+    }
 
-  vector<byte> buffer(message_length, byte {0});
-  memcpy(buffer.data(), data.data() + offset, buffer.size());
+    sent_number += result;
+  }
 
-  size_t buffer_offset = 0;
-  vector<StunAttribute> attributes;
+  for (size_t i = 0; i < sent_number; ++i)
+    TRACE_TRANSMIT(messages[i].get_transaction_id(), socket_, data[i].size());
 
-  while (buffer_offset < buffer.size() - 1)
+  if (ExchangeRecorder::instance().is_open())
   {
-    StunAttributeHeader attribute_header;
-    memcpy(&attribute_header, buffer.data() + buffer_offset, sizeof(StunAttributeHeader));
-    buffer_offset += sizeof(StunAttributeHeader);
+    for (size_t i = 0; i < sent_number; ++i)
+      ExchangeRecorder::instance().record(ExchangeDirection::Sent, ExchangeTransport::Udp, get_local_port(),
+          *static_cast<sockaddr_in*>(headers[i].msg_hdr.msg_name), data[i].data(), data[i].size());
+  }
 
-    uint16_t attribute_length = ntohs(attribute_header.length);
+  return sent_number;
+}
 
-    if (attribute_length <= 0)
-      continue;
+bool StunController::read_message(StunMessage& message) const
+{
+  timespec receive_time;
 
-    vector<byte> attribute_value(attribute_length, byte {0});
-    memcpy(attribute_value.data(), buffer.data() + buffer_offset, attribute_value.size());
-    buffer_offset += attribute_value.size();
+  return read_message(message, receive_time);
+}
+
+bool StunController::read_message(StunMessage& message, timespec& receive_time) const
+{
+  auto& buffer = get_receive_buffer();
+
+  struct sockaddr_in source;
+  char control[CMSG_SPACE(sizeof(timespec))];
+  iovec vector { buffer.data(), buffer.size() };
+
+  msghdr header;
+  memset(&header, 0, sizeof(header));
+  header.msg_name = &source;
+  header.msg_namelen = sizeof(source);
+  header.msg_iov = &vector;
+  header.msg_iovlen = 1;
+  header.msg_control = control;
+  header.msg_controllen = sizeof(control);
+
+  ssize_t size = recvmsg(socket_, &header, 0);
+  if (size < static_cast<ssize_t>(sizeof(StunMessageHeader)))
+    return false;
 
-    attributes.emplace_back(attribute_header, attribute_value);
+  clock_gettime(CLOCK_REALTIME, &receive_time);
+  for (auto control_header = CMSG_FIRSTHDR(&header); nullptr != control_header;
+      control_header = CMSG_NXTHDR(&header, control_header))
+  {
+    if (SOL_SOCKET == control_header->cmsg_level && SCM_TIMESTAMPNS == control_header->cmsg_type)
+      memcpy(&receive_time, CMSG_DATA(control_header), sizeof(receive_time));
   }
 
-  message.set_header(header);
-  message.set_attributes(attributes);
+  TRACE_RECEIVE(socket_, size, source.sin_addr.s_addr, source.sin_port, buffer.data());
+  if (ExchangeRecorder::instance().is_open())
+    ExchangeRecorder::instance().record(ExchangeDirection::Received, ExchangeTransport::Udp, get_local_port(),
+        source, buffer.data(), size, &receive_time);
+
+  message.set_data(buffer.data(), size);
+
+  char ip[INET_ADDRSTRLEN];
+  message.set_server(inet_ntop(AF_INET, &source.sin_addr, ip, INET_ADDRSTRLEN), ntohs(source.sin_port));
+
+  return true;
+}
+
+void StunController::discard_messages() const
+{
+  auto& buffer = get_receive_buffer();
+  while (-1 != recv(socket_, buffer.data(), buffer.size(), MSG_DONTWAIT))
+    ;
+}
+
+void StunController::enable_timestamps()
+{
+  int enable = 1;
+  if (-1 == setsockopt(socket_, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)))
+    throw Exception("Failed to enable receive timestamps for socket.");
 }
 
-bool StunController::validate_message(const StunMessage& message, const TransactionId& transaction_id) const
+int StunController::get_socket() const
+{
+  return socket_;
+}
+
+size_t StunController::get_local_port() const
+{
+  // Port of a socket doesn't change once it is bound.
+  if (0 != local_port_)
+    return local_port_;
+
+  struct sockaddr_in address;
+  socklen_t address_length = sizeof(address);
+  if (-1 == getsockname(socket_, (struct sockaddr *) &address, &address_length))
+    throw Exception("Failed to get local address of socket.");
+
+  local_port_ = ntohs(address.sin_port);
+
+  return local_port_;
+}
+
+bool StunController::validate_message(const StunMessage& message, const TransactionId& transaction_id)
 {
   if (!is_supported_message_type(message.get_type()))
     throw Exception("Failed to validate message: message type is not supported.");
@@ -146,7 +303,7 @@ bool StunController::validate_message(const StunMessage& message, const Transact
   }
 
   auto& attributes = message.get_attributes();
-  for (auto attribute : attributes)
+  for (const auto& attribute : attributes)
   {
     if ((StunMessageType::BindingErrorResponse == message.get_type() ||
           StunMessageType::BindingSuccessResponse == message.get_type()) &&
@@ -161,7 +318,7 @@ bool StunController::validate_message(const StunMessage& message, const Transact
   return true;
 }
 
-bool StunController::is_supported_message_type(uint16_t type) const
+bool StunController::is_supported_message_type(uint16_t type)
 {
   return StunMessageType::BindingSuccessResponse == type ||
     StunMessageType::BindingErrorResponse == type;
@@ -172,7 +329,8 @@ addrinfo* StunController::get_server_address(const string& server, const size_t
   struct addrinfo hints;
   struct addrinfo* result;
   memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family = AF_UNSPEC;
+  // Socket is AF_INET and resolved addresses are kept as sockaddr_in.
+  hints.ai_family = AF_INET;
   hints.ai_socktype = SOCK_DGRAM;
 
   auto ret = getaddrinfo(server.c_str(), to_string(port).c_str(), &hints, &result);
@@ -185,3 +343,18 @@ addrinfo* StunController::get_server_address(const string& server, const size_t
 
   return result;
 }
+
+const sockaddr_in& StunController::resolve_server_address(const string& server, const size_t port) const
+{
+  auto key = make_pair(server, port);
+  auto found = server_addresses_.find(key);
+  if (end(server_addresses_) != found)
+    return found->second;
+
+  addrinfo* address_info = get_server_address(server, port);
+  sockaddr_in address;
+  memcpy(&address, address_info->ai_addr, sizeof(address));
+  freeaddrinfo(address_info);
+
+  return server_addresses_[key] = address;
+}
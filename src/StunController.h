@@ -2,8 +2,12 @@
 #define STUN_CONTROLLER_H
 
 #include <netdb.h>
+#include <netinet/in.h>
+#include <ctime>
 #include <cstddef>
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "StunMessage.h"
@@ -12,6 +16,8 @@
 class StunController
 {
 public:
+  StunController();
+  explicit StunController(const std::string& local_address, const std::string& device = std::string());
   StunController(const StunController& controller) = delete;
   StunController& operator=(const StunController& controller) = delete;
   ~StunController();
@@ -19,20 +25,35 @@ public:
   static StunController& instance();
 
   void send_message(const StunMessage& message) const;
+  // Sends all messages with as few system calls as possible (sendmmsg),
+  // destinations are resolved once and cached. Returns number of sent messages.
+  size_t send_messages(const std::vector<StunMessage>& messages) const;
   bool recieve_message(StunMessage& message, const TransactionId& transaction_id) const;
+  // Reads a pending datagram without waiting, the sender is stored as message server.
+  bool read_message(StunMessage& message) const;
+  // Same as read_message, also returns kernel receive time if enable_timestamps() was called.
+  bool read_message(StunMessage& message, timespec& receive_time) const;
+  // Drops queued datagrams, e.g. late responses of transactions which are already finished.
+  void discard_messages() const;
+  void enable_timestamps();
 
-  bool validate_message(const StunMessage& message, const TransactionId& transaction_id) const;
+  static bool validate_message(const StunMessage& message, const TransactionId& transaction_id);
 
-private:
-  StunController();
+  int get_socket() const;
+  // Zero until the socket is bound explicitly or by the first sent datagram.
+  size_t get_local_port() const;
 
-  void parse_data(const std::vector<std::byte>& data, StunMessage& message) const;
+  const sockaddr_in& resolve_server_address(const std::string& server, const size_t port) const;
+
+private:
   addrinfo* get_server_address(const std::string& server, const size_t port) const;
 
-  bool is_supported_message_type(uint16_t type) const;
+  static bool is_supported_message_type(uint16_t type);
 
 private:
   int socket_;
+  mutable size_t local_port_ = 0;
+  mutable std::map<std::pair<std::string, size_t>, sockaddr_in> server_addresses_;
 };
 
 #endif /* end of include guard: STUN_CONTROLLER_H */
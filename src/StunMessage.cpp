@@ -7,6 +7,8 @@
 #include <numeric>
 #include <algorithm>
 
+#include "Tracepoints.h"
+
 using namespace std;
 
 
@@ -15,7 +17,14 @@ StunMessage::StunMessage()
   header_.type = StunMessageType::Unknown;
 }
 
-StunMessage::StunMessage(const string& server, const size_t port, const StunMessageType type)
+StunMessage::StunMessage(const allocator_type& allocator) : attributes_(allocator)
+{
+  header_.type = StunMessageType::Unknown;
+}
+
+StunMessage::StunMessage(const string& server, const size_t port, const StunMessageType type,
+    const allocator_type& allocator) :
+  attributes_(allocator)
 {
   header_.type = htons(type);
   header_.length = 0;
@@ -37,29 +46,30 @@ TransactionId StunMessage::generate_transaction_id()
   return transaction_id;
 }
 
+StunMessage::StunMessage(const StunMessage& message, const allocator_type& allocator) :
+  attributes_(message.attributes_, allocator), server_(message.server_), port_(message.port_),
+  header_(message.header_)
+{
+}
+
 void StunMessage::add_string_attribute(StunAttributeType type, const string& value)
 {
   size_t length = value.length();
   length += (value.length() % 4 == 0 ? 0 : 4 - value.length() % 4);
-  vector<byte> buffer(length, byte {0});
+  pmr::vector<byte> buffer(length, byte {0}, attributes_.get_allocator());
   memcpy(buffer.data(), value.data(), value.length());
 
-  StunAttribute attribute(type, length, buffer);
-  attributes_.push_back(attribute);
+  attributes_.emplace_back(type, buffer.data(), buffer.size());
 
   header_.length = htons(ntohs(header_.length) + sizeof(StunAttributeHeader) + length);
 }
 
 void StunMessage::add_int_attribute(StunAttributeType type, uint32_t value)
 {
-  vector<byte> buffer(sizeof(uint32_t), byte {0});
   uint32_t v = htonl(value);
-  memcpy(buffer.data(), &v, sizeof(uint32_t));
-
-  StunAttribute attribute(type, buffer.size(), buffer);
-  attributes_.push_back(attribute);
+  attributes_.emplace_back(type, reinterpret_cast<const byte*>(&v), sizeof(v));
 
-  header_.length = htons(ntohs(header_.length) + sizeof(StunAttributeHeader) + buffer.size());
+  header_.length = htons(ntohs(header_.length) + sizeof(StunAttributeHeader) + sizeof(v));
 }
 
 vector<byte> StunMessage::get_data() const
@@ -75,7 +85,7 @@ vector<byte> StunMessage::get_data() const
   memcpy(data.data() + offset, &header_, sizeof(header_));
   offset += sizeof(header_);
 
-  for (auto attribute : attributes_)
+  for (const auto& attribute : attributes_)
   {
     memcpy(data.data() + offset, &attribute.get_header(), sizeof(StunAttributeHeader));
     offset += sizeof(StunAttributeHeader);
@@ -86,6 +96,38 @@ vector<byte> StunMessage::get_data() const
   return data;
 }
 
+void StunMessage::set_data(const byte* data, size_t size)
+{
+  attributes_.clear();
+  if (size < sizeof(StunMessageHeader))
+    return;
+
+  memcpy(&header_, data, sizeof(StunMessageHeader));
+  size_t offset = sizeof(StunMessageHeader);
+  size_t end_offset = offset + min<size_t>(ntohs(header_.length), size - offset);
+
+  while (offset + sizeof(StunAttributeHeader) <= end_offset)
+  {
+    StunAttributeHeader attribute_header;
+    memcpy(&attribute_header, data + offset, sizeof(StunAttributeHeader));
+    offset += sizeof(StunAttributeHeader);
+
+    uint16_t attribute_length = ntohs(attribute_header.length);
+
+    if (attribute_length <= 0)
+      continue;
+
+    if (attribute_length > end_offset - offset)
+      break;
+
+    attributes_.emplace_back(attribute_header, data + offset, attribute_length);
+    // Values are padded to a multiple of 4 bytes.
+    offset += (attribute_length + 3) / 4 * 4;
+  }
+
+  TRACE_DECODE(header_.transaction_id, get_type(), attributes_.size());
+}
+
 const TransactionId& StunMessage::get_transaction_id() const
 {
   return header_.transaction_id;
@@ -116,21 +158,32 @@ size_t StunMessage::get_port() const
   return port_;
 }
 
+void StunMessage::set_server(const string& server, size_t port)
+{
+  server_ = server;
+  port_ = port;
+}
+
 void StunMessage::set_header(const StunMessageHeader& header)
 {
   header_ = header;
 }
 
-void StunMessage::set_attributes(const vector<StunAttribute>& attributes)
+void StunMessage::set_attributes(const pmr::vector<StunAttribute>& attributes)
 {
   attributes_ = attributes;
 }
 
-const vector<StunAttribute>& StunMessage::get_attributes() const
+const pmr::vector<StunAttribute>& StunMessage::get_attributes() const
 {
   return attributes_;
 }
 
+StunMessage::allocator_type StunMessage::get_allocator() const
+{
+  return attributes_.get_allocator();
+}
+
 const StunAttribute* StunMessage::get_attribute(StunAttributeType type) const
 {
   auto find_functor = [type](const StunAttribute& attribute)
@@ -143,3 +196,31 @@ const StunAttribute* StunMessage::get_attribute(StunAttributeType type) const
 
   return &(*found);
 }
+
+bool StunMessage::get_mapped_address(string& address, size_t& port) const
+{
+  auto attribute = get_attribute(StunAttributeType::XorMappedAddress1);
+  if (nullptr == attribute)
+    attribute = get_attribute(StunAttributeType::XorMappedAddress2);
+
+  if (nullptr != attribute)
+  {
+    StunXorMappedAddressAdapter mapped_address(attribute);
+    address = mapped_address.get_address(get_transaction_id());
+    port = mapped_address.get_port();
+
+    return true;
+  }
+
+  attribute = get_attribute(StunAttributeType::MappedAddress);
+  if (nullptr != attribute)
+  {
+    StunMappedAddressAdapter mapped_address(attribute);
+    address = mapped_address.get_address();
+    port = mapped_address.get_port();
+
+    return true;
+  }
+
+  return false;
+}
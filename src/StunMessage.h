@@ -3,6 +3,8 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <memory_resource>
+#include <string>
 #include <vector>
 
 #include "StunAttribute.h"
@@ -28,13 +30,27 @@ struct StunMessageHeader
   TransactionId transaction_id;
 };
 
+// Attributes live in memory of the allocator. Copies use the default resource unless another allocator
+// is given, so a message kept out of a short-lived arena is copied rather than moved.
 class StunMessage
 {
 public:
+  using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
   StunMessage();
-  StunMessage(const std::string& server, const size_t port, const StunMessageType type);
+  explicit StunMessage(const allocator_type& allocator);
+  StunMessage(const std::string& server, const size_t port, const StunMessageType type,
+      const allocator_type& allocator = {});
+  StunMessage(const StunMessage& message) = default;
+  StunMessage(const StunMessage& message, const allocator_type& allocator);
+  StunMessage(StunMessage&& message) = default;
+  StunMessage& operator=(const StunMessage& message) = default;
+  StunMessage& operator=(StunMessage&& message) = default;
 
   std::vector<std::byte> get_data() const;
+  // Decodes a received datagram. Storage of the attribute vector is reused,
+  // values of the attributes are allocated again.
+  void set_data(const std::byte* data, size_t size);
   void add_string_attribute(StunAttributeType type, const std::string& value);
   void add_int_attribute(StunAttributeType type, uint32_t value);
 
@@ -45,19 +61,23 @@ public:
 
   const std::string& get_server() const;
   size_t get_port() const;
+  void set_server(const std::string& server, size_t port);
 
   void set_header(const StunMessageHeader& header);
 
-  void set_attributes(const std::vector<StunAttribute>& attributes);
-  const std::vector<StunAttribute>& get_attributes() const;
+  void set_attributes(const std::pmr::vector<StunAttribute>& attributes);
+  const std::pmr::vector<StunAttribute>& get_attributes() const;
+  allocator_type get_allocator() const;
 
   const StunAttribute* get_attribute(StunAttributeType type) const;
+  // Reads XOR-MAPPED-ADDRESS or, if it is absent, MAPPED-ADDRESS.
+  bool get_mapped_address(std::string& address, size_t& port) const;
 
 private:
   static TransactionId generate_transaction_id();
 
 private:
-  std::vector<StunAttribute> attributes_;
+  std::pmr::vector<StunAttribute> attributes_;
   std::string server_;
   size_t port_;
   StunMessageHeader header_;
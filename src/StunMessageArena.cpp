@@ -0,0 +1,88 @@
+#include "StunMessageArena.h"
+
+
+using namespace std;
+
+
+/************************** CountingMemoryResource ****************************/
+
+CountingMemoryResource::CountingMemoryResource(pmr::memory_resource* upstream) : upstream_(upstream)
+{
+}
+
+size_t CountingMemoryResource::get_allocations_number() const
+{
+  return allocations_number_;
+}
+
+size_t CountingMemoryResource::get_allocated_bytes() const
+{
+  return allocated_bytes_;
+}
+
+void CountingMemoryResource::reset_counters()
+{
+  allocations_number_ = 0;
+  allocated_bytes_ = 0;
+}
+
+void* CountingMemoryResource::do_allocate(size_t bytes, size_t alignment)
+{
+  ++allocations_number_;
+  allocated_bytes_ += bytes;
+
+  return upstream_->allocate(bytes, alignment);
+}
+
+void CountingMemoryResource::do_deallocate(void* pointer, size_t bytes, size_t alignment)
+{
+  upstream_->deallocate(pointer, bytes, alignment);
+}
+
+bool CountingMemoryResource::do_is_equal(const pmr::memory_resource& other) const noexcept
+{
+  return this == &other;
+}
+
+
+/***************************** StunMessageArena *******************************/
+
+StunMessageArena::Batch::Batch() : arena_(StunMessageArena::thread_instance())
+{
+  ++arena_.batches_number_;
+}
+
+StunMessageArena::Batch::~Batch()
+{
+  if (0 == --arena_.batches_number_)
+    arena_.reset();
+}
+
+pmr::memory_resource* StunMessageArena::Batch::get_resource() const
+{
+  return arena_.get_resource();
+}
+
+StunMessageArena::StunMessageArena(pmr::memory_resource* upstream) :
+  pool_(pmr::pool_options { 0, pool_block_size_ }, upstream),
+  arena_(initial_buffer_, sizeof(initial_buffer_), &pool_)
+{
+}
+
+StunMessageArena& StunMessageArena::thread_instance()
+{
+  thread_local StunMessageArena arena;
+
+  return arena;
+}
+
+pmr::memory_resource* StunMessageArena::get_resource()
+{
+  return &arena_;
+}
+
+void StunMessageArena::reset()
+{
+  // Blocks go back to the pool, the initial buffer is reused as is.
+  arena_.release();
+}
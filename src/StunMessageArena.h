@@ -0,0 +1,73 @@
+#ifndef STUN_MESSAGE_ARENA_H
+#define STUN_MESSAGE_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+
+// Memory resource which counts allocations passed to its upstream.
+class CountingMemoryResource : public std::pmr::memory_resource
+{
+public:
+  explicit CountingMemoryResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+
+  size_t get_allocations_number() const;
+  size_t get_allocated_bytes() const;
+  void reset_counters();
+
+protected:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+  std::pmr::memory_resource* upstream_;
+  size_t allocations_number_ = 0;
+  size_t allocated_bytes_ = 0;
+};
+
+// Per-thread memory for messages received in one I/O batch. Messages are
+// decoded into a monotonic arena which is released in bulk when the batch
+// ends, its blocks come from a pool of the thread and are reused by the next
+// batch. Messages kept longer must be copied out of the arena.
+class StunMessageArena
+{
+public:
+  // Marks an I/O batch, the arena is released when the outermost batch of
+  // the thread ends, so a handler may run a nested loop safely.
+  class Batch
+  {
+  public:
+    Batch();
+    Batch(const Batch& batch) = delete;
+    Batch& operator=(const Batch& batch) = delete;
+    ~Batch();
+
+    std::pmr::memory_resource* get_resource() const;
+
+  private:
+    StunMessageArena& arena_;
+  };
+
+  explicit StunMessageArena(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+  StunMessageArena(const StunMessageArena& arena) = delete;
+  StunMessageArena& operator=(const StunMessageArena& arena) = delete;
+
+  static StunMessageArena& thread_instance();
+
+  std::pmr::memory_resource* get_resource();
+  // Frees everything allocated since the previous reset at once.
+  void reset();
+
+private:
+  static constexpr size_t initial_size_ = 16 * 1024;
+  // Arena grows geometrically, blocks up to this size are kept by the pool.
+  static constexpr size_t pool_block_size_ = 256 * 1024;
+
+  std::byte initial_buffer_[initial_size_];
+  std::pmr::unsynchronized_pool_resource pool_;
+  std::pmr::monotonic_buffer_resource arena_;
+  size_t batches_number_ = 0;
+};
+
+#endif /* end of include guard: STUN_MESSAGE_ARENA_H */
@@ -0,0 +1,285 @@
+#include "StunTcpController.h"
+
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+#include "Exception.h"
+#include "ExchangeLog.h"
+#include "StunController.h"
+#include "Tracepoints.h"
+
+
+using namespace std;
+
+
+namespace
+{
+
+int connect_to_server(const string& server, size_t port, int timeout, sockaddr_in& peer)
+{
+  struct addrinfo hints;
+  struct addrinfo* address_info;
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  auto ret = getaddrinfo(server.c_str(), to_string(port).c_str(), &hints, &address_info);
+  if (0 != ret)
+  {
+    stringstream stream;
+    stream << "Failed to get information about " << server << " server. Error: " << gai_strerror(ret);
+    throw Exception(stream.str());
+  }
+
+  for (auto ai = address_info; nullptr != ai; ai = ai->ai_next)
+  {
+    int connection = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (-1 == connection)
+      continue;
+
+    pollfd descriptor { connection, POLLOUT, 0 };
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    if ((0 == connect(connection, ai->ai_addr, ai->ai_addrlen) ||
+          (EINPROGRESS == errno && poll(&descriptor, 1, timeout) > 0 &&
+           0 == getsockopt(connection, SOL_SOCKET, SO_ERROR, &error, &error_length) && 0 == error)))
+    {
+      // Pipelined requests must not wait for acknowledgements of earlier ones.
+      int enable = 1;
+      setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+      memcpy(&peer, ai->ai_addr, sizeof(peer));
+      freeaddrinfo(address_info);
+
+      return connection;
+    }
+
+    close(connection);
+  }
+
+  freeaddrinfo(address_info);
+
+  stringstream stream;
+  stream << "Failed to connect to " << server << ":" << port << " over TCP.";
+  throw Exception(stream.str());
+}
+
+}
+
+
+StunTcpController::~StunTcpController()
+{
+  for (auto& item : connections_)
+    close(item.second.socket);
+}
+
+void StunTcpController::send_message(const StunMessage& message)
+{
+  send_messages({ message });
+}
+
+void StunTcpController::send_messages(const vector<StunMessage>& messages)
+{
+  map<ServerKey, vector<byte>> data;
+  for (auto& message : messages)
+  {
+    auto message_data = message.get_data();
+    auto& server_data = data[ServerKey(message.get_server(), message.get_port())];
+    server_data.insert(end(server_data), begin(message_data), end(message_data));
+  }
+
+  for (auto& item : data)
+  {
+    auto& connection = get_connection(item.first);
+    write_data(item.first, item.second);
+
+    for (auto& message : messages)
+    {
+      if (ServerKey(message.get_server(), message.get_port()) != item.first)
+        continue;
+
+      pending_requests_[message.get_transaction_id()] = item.first;
+      TRACE_TRANSMIT(message.get_transaction_id(), connection.socket,
+          sizeof(StunMessageHeader) + message.get_length());
+      if (ExchangeRecorder::instance().is_open())
+      {
+        auto message_data = message.get_data();
+        ExchangeRecorder::instance().record(ExchangeDirection::Sent, ExchangeTransport::Tcp, connection.local_port,
+            connection.peer, message_data.data(), message_data.size());
+      }
+    }
+  }
+}
+
+bool StunTcpController::recieve_message(StunMessage& message, const TransactionId& transaction_id, size_t timeout)
+{
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+
+  while (true)
+  {
+    auto response = responses_.find(transaction_id);
+    if (end(responses_) != response)
+    {
+      message = response->second;
+      responses_.erase(response);
+
+      return StunController::validate_message(message, transaction_id);
+    }
+
+    // Requests of a lost connection are forgotten with it.
+    auto request = pending_requests_.find(transaction_id);
+    if (end(pending_requests_) == request)
+      return false;
+
+    auto now = chrono::steady_clock::now();
+    if (now >= deadline)
+    {
+      pending_requests_.erase(request);
+      return false;
+    }
+
+    ServerKey key = request->second;
+    auto& connection = connections_.at(key);
+    pollfd descriptor { connection.socket, POLLIN, 0 };
+    int result = poll(&descriptor, 1, chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1);
+    if (-1 == result && EINTR != errno)
+      throw Exception("Failed to poll TCP connection.");
+
+    if (result > 0 && !read_connection(connection))
+      close_connection(key);
+  }
+}
+
+StunTcpController::Connection& StunTcpController::get_connection(const ServerKey& key)
+{
+  auto found = connections_.find(key);
+  if (end(connections_) != found)
+    return found->second;
+
+  Connection connection;
+  connection.socket = connect_to_server(key.first, key.second, connect_timeout_, connection.peer);
+
+  // Looked up once, so recording of every message doesn't cost a system call.
+  struct sockaddr_in local;
+  socklen_t local_length = sizeof(local);
+  if (0 == getsockname(connection.socket, (struct sockaddr *) &local, &local_length))
+    connection.local_port = ntohs(local.sin_port);
+  connection.buffer.resize(buffer_size_);
+
+  return connections_.emplace(key, move(connection)).first->second;
+}
+
+void StunTcpController::close_connection(const ServerKey& key)
+{
+  auto found = connections_.find(key);
+  if (end(connections_) == found)
+    return;
+
+  close(found->second.socket);
+  connections_.erase(found);
+
+  for (auto request = begin(pending_requests_); end(pending_requests_) != request;)
+  {
+    if (request->second == key)
+      request = pending_requests_.erase(request);
+    else
+      ++request;
+  }
+}
+
+void StunTcpController::write_data(const ServerKey& key, const vector<byte>& data)
+{
+  auto& connection = connections_.at(key);
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(connect_timeout_);
+
+  size_t offset = 0;
+  while (offset < data.size())
+  {
+    ssize_t size = send(connection.socket, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+    if (size > 0)
+    {
+      offset += size;
+      continue;
+    }
+
+    auto now = chrono::steady_clock::now();
+    if (-1 == size && EINTR == errno)
+      continue;
+
+    if (-1 == size && (EAGAIN == errno || EWOULDBLOCK == errno) && now < deadline)
+    {
+      pollfd descriptor { connection.socket, POLLOUT, 0 };
+      poll(&descriptor, 1, chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1);
+      continue;
+    }
+
+    stringstream stream;
+    stream << "Failed to send message to " << key.first << ":" << key.second << " over TCP.";
+    close_connection(key);
+    throw Exception(stream.str());
+  }
+}
+
+bool StunTcpController::read_connection(Connection& connection)
+{
+  while (true)
+  {
+    ssize_t size = recv(connection.socket, connection.buffer.data() + connection.end,
+        connection.buffer.size() - connection.end, MSG_DONTWAIT);
+    if (0 == size)
+      return false;
+
+    if (-1 == size)
+      return EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno;
+
+    connection.end += size;
+    extract_messages(connection);
+  }
+}
+
+void StunTcpController::extract_messages(Connection& connection)
+{
+  while (connection.end - connection.begin >= sizeof(StunMessageHeader))
+  {
+    const byte* data = connection.buffer.data() + connection.begin;
+
+    StunMessageHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t size = sizeof(header) + ntohs(header.length);
+    if (connection.end - connection.begin < size)
+      break;
+
+    TRACE_RECEIVE(connection.socket, size, connection.peer.sin_addr.s_addr, connection.peer.sin_port, data);
+    if (ExchangeRecorder::instance().is_open())
+      ExchangeRecorder::instance().record(ExchangeDirection::Received, ExchangeTransport::Tcp, connection.local_port,
+          connection.peer, data, size);
+
+    // Only responses somebody waits for are decoded.
+    if (end(pending_requests_) != pending_requests_.find(header.transaction_id))
+    {
+      responses_[header.transaction_id].set_data(data, size);
+      pending_requests_.erase(header.transaction_id);
+    }
+
+    connection.begin += size;
+  }
+
+  if (connection.begin == connection.end)
+  {
+    connection.begin = 0;
+    connection.end = 0;
+  }
+  else if (connection.end == connection.buffer.size())
+  {
+    memmove(connection.buffer.data(), connection.buffer.data() + connection.begin, connection.end - connection.begin);
+    connection.end -= connection.begin;
+    connection.begin = 0;
+  }
+}
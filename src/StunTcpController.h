@@ -0,0 +1,70 @@
+#ifndef STUN_TCP_CONTROLLER_H
+#define STUN_TCP_CONTROLLER_H
+
+#include <netinet/in.h>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "StunMessage.h"
+
+
+// STUN over TCP (RFC 5389, section 7.2.2). Every server gets one persistent
+// connection, opened on first use, which carries pipelined requests: they go
+// out without waiting for earlier responses, and responses are matched to
+// them by transaction ID in whatever order they come. The stream is framed by
+// message header length and messages are decoded in place from the receive
+// buffer, only an incomplete tail is moved to the front when the buffer is
+// full. Requests aren't retransmitted over a reliable transport.
+class StunTcpController
+{
+public:
+  StunTcpController() = default;
+  StunTcpController(const StunTcpController& controller) = delete;
+  StunTcpController& operator=(const StunTcpController& controller) = delete;
+  ~StunTcpController();
+
+  void send_message(const StunMessage& message);
+  // Requests to one server are written to its connection at once.
+  void send_messages(const std::vector<StunMessage>& messages);
+  // Waits for the response to a sent request up to timeout milliseconds,
+  // responses to other requests read meanwhile are kept for them. Returns
+  // false on timeout or if the connection is lost.
+  bool recieve_message(StunMessage& message, const TransactionId& transaction_id,
+      size_t timeout = response_timeout_);
+
+private:
+  using ServerKey = std::pair<std::string, size_t>;
+
+  struct Connection
+  {
+    int socket = -1;
+    sockaddr_in peer;
+    size_t local_port = 0;
+    std::vector<std::byte> buffer;
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  Connection& get_connection(const ServerKey& key);
+  void close_connection(const ServerKey& key);
+  void write_data(const ServerKey& key, const std::vector<std::byte>& data);
+  // Returns false if the connection is closed by the server or fails.
+  bool read_connection(Connection& connection);
+  void extract_messages(Connection& connection);
+
+private:
+  static constexpr size_t connect_timeout_ = 3000;
+  // Ti of RFC 5389.
+  static constexpr size_t response_timeout_ = 39500;
+  // The longest message fits once the buffer is compacted.
+  static constexpr size_t buffer_size_ = sizeof(StunMessageHeader) + 65535;
+
+  std::map<ServerKey, Connection> connections_;
+  std::map<TransactionId, ServerKey> pending_requests_;
+  std::map<TransactionId, StunMessage> responses_;
+};
+
+#endif /* end of include guard: STUN_TCP_CONTROLLER_H */
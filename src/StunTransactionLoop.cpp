@@ -0,0 +1,177 @@
+#include "StunTransactionLoop.h"
+
+#include <poll.h>
+#include <cerrno>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "Exception.h"
+#include "StunController.h"
+#include "StunMessageArena.h"
+#include "Tracepoints.h"
+
+
+using namespace std;
+
+
+void StunTransactionLoop::add_transaction(StunController& controller, const StunMessage& request,
+    ResponseHandler handler, size_t attempts_number, size_t rto, StunController* sender)
+{
+  if (nullptr == sender)
+    sender = &controller;
+
+  TRACE_TRANSACTION_START(request.get_transaction_id(), request.get_server().c_str(), request.get_port());
+  sender->send_message(request);
+
+  Transaction transaction { &controller, sender, request, move(handler), attempts_number - 1,
+    chrono::milliseconds(rto), Clock::now() + chrono::milliseconds(rto) };
+  transactions_[request.get_transaction_id()] = move(transaction);
+}
+
+void StunTransactionLoop::add_timer(chrono::milliseconds delay, TimerHandler handler)
+{
+  timers_.emplace(Clock::now() + delay, move(handler));
+}
+
+void StunTransactionLoop::run()
+{
+  while (!is_empty())
+  {
+    poll_sockets(get_poll_timeout());
+    process_timeouts();
+    process_timers();
+  }
+}
+
+bool StunTransactionLoop::is_empty() const
+{
+  return transactions_.empty() && timers_.empty();
+}
+
+void StunTransactionLoop::poll_sockets(int timeout)
+{
+  set<StunController*> controllers;
+  for (auto& item : transactions_)
+    controllers.insert(item.second.controller);
+
+  vector<pollfd> descriptors;
+  for (auto controller : controllers)
+    descriptors.push_back(pollfd { controller->get_socket(), POLLIN, 0 });
+
+  int result = poll(descriptors.data(), descriptors.size(), timeout);
+  if (-1 == result)
+  {
+    if (EINTR == errno)
+      return;
+
+    throw Exception("Failed to poll sockets.");
+  }
+
+  // Responses are copied by handlers which keep them, the rest is released with the batch.
+  StunMessageArena::Batch batch;
+  for (auto controller : controllers)
+  {
+    auto descriptor = find_if(begin(descriptors), end(descriptors),
+        [controller](const pollfd& item) { return item.fd == controller->get_socket(); });
+    if (0 == (descriptor->revents & POLLIN))
+      continue;
+
+    StunMessage response(batch.get_resource());
+    while (controller->read_message(response))
+    {
+      auto found = transactions_.find(response.get_transaction_id());
+      if (end(transactions_) == found || found->second.controller != controller)
+        continue;
+
+      // Own request coming back through NAT (hairpinning) completes its transaction as is.
+      try
+      {
+        if (StunMessageType::BindingRequest != response.get_type())
+          controller->validate_message(response, found->first);
+      }
+      catch (const Exception&)
+      {
+        continue;
+      }
+
+      complete_transaction(found->first, response);
+    }
+  }
+}
+
+void StunTransactionLoop::process_timeouts()
+{
+  auto now = Clock::now();
+
+  vector<TransactionId> expired;
+  for (auto& item : transactions_)
+  {
+    auto& transaction = item.second;
+    if (transaction.deadline > now)
+      continue;
+
+    if (0 == transaction.attempts_left)
+    {
+      expired.push_back(item.first);
+      continue;
+    }
+
+    try
+    {
+      transaction.sender->send_message(transaction.request);
+    }
+    catch (const Exception&)
+    {
+      // A lost retransmission is handled like a lost datagram.
+    }
+
+    --transaction.attempts_left;
+    transaction.rto *= 2;
+    transaction.deadline = now + transaction.rto;
+  }
+
+  for (auto& transaction_id : expired)
+    complete_transaction(transaction_id, StunMessage());
+}
+
+void StunTransactionLoop::process_timers()
+{
+  auto now = Clock::now();
+  while (!timers_.empty() && begin(timers_)->first <= now)
+  {
+    // Handler can add new timers, so it is taken out of the map first.
+    TimerHandler handler = move(begin(timers_)->second);
+    timers_.erase(begin(timers_));
+
+    handler();
+  }
+}
+
+void StunTransactionLoop::complete_transaction(const TransactionId& transaction_id, const StunMessage& response)
+{
+  auto found = transactions_.find(transaction_id);
+  if (end(transactions_) == found)
+    return;
+
+  // Handler can add new transactions, so it is taken out of the map first.
+  ResponseHandler handler = move(found->second.handler);
+  transactions_.erase(found);
+
+  handler(response);
+}
+
+int StunTransactionLoop::get_poll_timeout() const
+{
+  auto now = Clock::now();
+  auto deadline = Clock::time_point::max();
+  for (auto& item : transactions_)
+    deadline = min(deadline, item.second.deadline);
+  if (!timers_.empty())
+    deadline = min(deadline, begin(timers_)->first);
+
+  if (deadline <= now)
+    return 0;
+
+  return chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1;
+}
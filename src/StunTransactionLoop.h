@@ -0,0 +1,62 @@
+#ifndef STUN_TRANSACTION_LOOP_H
+#define STUN_TRANSACTION_LOOP_H
+
+#include <cstddef>
+#include <chrono>
+#include <functional>
+#include <map>
+
+#include "StunMessage.h"
+
+
+class StunController;
+
+
+// Runs STUN transactions of many controllers concurrently on one poll() loop.
+// Every request is retransmitted with doubling RTO until a response arrives or
+// attempts are exhausted, then its handler is called with the response or with
+// a StunMessageType::Unknown message on timeout. A request received back with
+// its own transaction ID (hairpinning) is passed to the handler as well.
+// A request may be sent from another controller than the one its response is
+// expected on. Timers run handlers after a delay. Handlers may add new transactions and
+// timers, run() returns when nothing is pending.
+class StunTransactionLoop
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using ResponseHandler = std::function<void(const StunMessage& response)>;
+  using TimerHandler = std::function<void()>;
+
+  void add_transaction(StunController& controller, const StunMessage& request, ResponseHandler handler,
+      size_t attempts_number, size_t rto, StunController* sender = nullptr);
+  void add_timer(std::chrono::milliseconds delay, TimerHandler handler);
+
+  void run();
+
+  bool is_empty() const;
+
+private:
+  struct Transaction
+  {
+    StunController* controller;
+    StunController* sender;
+    StunMessage request;
+    ResponseHandler handler;
+    size_t attempts_left;
+    std::chrono::milliseconds rto;
+    Clock::time_point deadline;
+  };
+
+  void poll_sockets(int timeout);
+  void process_timeouts();
+  void process_timers();
+  void complete_transaction(const TransactionId& transaction_id, const StunMessage& response);
+
+  int get_poll_timeout() const;
+
+private:
+  std::map<TransactionId, Transaction> transactions_;
+  std::multimap<Clock::time_point, TimerHandler> timers_;
+};
+
+#endif /* end of include guard: STUN_TRANSACTION_LOOP_H */
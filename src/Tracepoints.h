@@ -0,0 +1,45 @@
+#ifndef TRACEPOINTS_H
+#define TRACEPOINTS_H
+
+// Static USDT probes of the nat_type_detector provider, for bpftrace, perf
+// and SystemTap. A disabled probe is a single nop in the code and a note in
+// the ELF file. Without sys/sdt.h or with NAT_TYPE_DETECTOR_TRACEPOINTS=OFF
+// the macros expand to nothing and their arguments aren't evaluated.
+//
+// Transaction IDs are passed as three 32-bit words, addresses and ports as on
+// the wire, texts as C strings:
+//   transaction__start(id0, id1, id2, server, port)     first transmission
+//   transmit(id0, id1, id2, socket, size)                every datagram sent
+//   receive(socket, size, address, port, data)           every datagram received
+//   decode(id0, id1, id2, type, attributes_number)       message decoded
+//   verdict(is_nat_present, is_firewall_present, nat_type, public_ip)
+
+#ifdef WITH_TRACEPOINTS
+
+#include <sys/sdt.h>
+
+#define TRACE_TRANSACTION_START(transaction_id, server, port) \
+  DTRACE_PROBE5(nat_type_detector, transaction__start, (transaction_id)[0], (transaction_id)[1], \
+      (transaction_id)[2], (server), (port))
+#define TRACE_TRANSMIT(transaction_id, socket, size) \
+  DTRACE_PROBE5(nat_type_detector, transmit, (transaction_id)[0], (transaction_id)[1], (transaction_id)[2], \
+      (socket), (size))
+#define TRACE_RECEIVE(socket, size, address, port, data) \
+  DTRACE_PROBE5(nat_type_detector, receive, (socket), (size), (address), (port), (data))
+#define TRACE_DECODE(transaction_id, type, attributes_number) \
+  DTRACE_PROBE5(nat_type_detector, decode, (transaction_id)[0], (transaction_id)[1], (transaction_id)[2], \
+      (type), (attributes_number))
+#define TRACE_VERDICT(is_nat_present, is_firewall_present, nat_type, public_ip) \
+  DTRACE_PROBE4(nat_type_detector, verdict, (is_nat_present), (is_firewall_present), (nat_type), (public_ip))
+
+#else
+
+#define TRACE_TRANSACTION_START(transaction_id, server, port) do {} while (0)
+#define TRACE_TRANSMIT(transaction_id, socket, size) do {} while (0)
+#define TRACE_RECEIVE(socket, size, address, port, data) do {} while (0)
+#define TRACE_DECODE(transaction_id, type, attributes_number) do {} while (0)
+#define TRACE_VERDICT(is_nat_present, is_firewall_present, nat_type, public_ip) do {} while (0)
+
+#endif
+
+#endif /* end of include guard: TRACEPOINTS_H */
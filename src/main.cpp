@@ -1,25 +1,353 @@
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 #include "NatTypeDetector.h"
+#include "StunController.h"
+#include "StunTcpController.h"
+#include "MultiInterfaceDetector.h"
+#include "DetectionDaemon.h"
+#include "NatMonitor.h"
+#include "BindingLifetimeProbe.h"
+#include "BehaviorDiscovery.h"
+#include "PortAllocationSampler.h"
+#include "KeepaliveScheduler.h"
+#include "DecodeBenchmark.h"
+#include "ExchangeLog.h"
+#include "ExchangeReplay.h"
+#include "ResultCache.h"
 #include "Exception.h"
 
 using namespace std;
 
 
+enum class Mode
+{
+  Detect,
+  AllInterfaces,
+  Daemon,
+  Query,
+  Watch,
+  Monitor,
+  Lifetime,
+  Behavior,
+  PortSampling,
+  Keepalive,
+  DecodeBenchmark,
+  Replay
+};
+
+void print_usage(const char* program)
+{
+  cout << "Usage: " << program << " [options] server1 server2" << endl
+    << "       " << program << " --lifetime [options] server" << endl
+    << "       " << program << " --behavior server" << endl
+    << "       " << program << " --port-sampling [--sockets number] server" << endl
+    << "       " << program << " --keepalive [--sockets number] [--interval seconds] server" << endl
+    << "       " << program << " --query|--watch [--socket path]" << endl
+    << "       " << program << " --decode-benchmark [--packets number] [--corpus path]" << endl
+    << "       " << program << " --replay path" << endl
+    << "Options:" << endl
+    << "  --all-interfaces  detect NAT type from every local interface concurrently" << endl
+    << "  --bind-device     bind sockets to their interfaces (SO_BINDTODEVICE), requires --all-interfaces"
+    << endl
+    << "  --tcp-fallback    repeat test 1 over TCP if UDP is blocked" << endl
+    << "  --cache           reuse result cached for the current network if test 1 confirms it" << endl
+    << "  --cache-file path cache file, default: " << ResultCache::get_default_path() << endl
+    << "  --daemon          keep detection result fresh and serve it to local processes" << endl
+    << "  --refresh seconds interval of repeated detection in daemon mode, default: 300" << endl
+    << "  --monitor         probe mapping every interval and re-detect NAT type when it changes" << endl
+    << "  --interval seconds probe interval of --monitor or refresh interval of --keepalive, default: 30"
+    << endl
+    << "  --behavior        discover mapping, filtering and hairpinning behavior (RFC 5780)" << endl
+    << "  --port-sampling   predict port allocation of new mappings from a burst of requests" << endl
+    << "  --keepalive       keep mappings of many sockets alive and report their changes" << endl
+    << "  --lifetime        find how long NAT keeps an idle UDP mapping" << endl
+    << "  --sockets number  sockets used by --lifetime (default: 20), --port-sampling (default: 64)" << endl
+    << "                    or --keepalive (default: 100)" << endl
+    << "  --min-lifetime seconds  shortest idle time tried by --lifetime, default: 1" << endl
+    << "  --max-lifetime seconds  longest idle time tried by --lifetime, default: 600" << endl
+    << "  --resolution seconds    width of the interval at which --lifetime stops, default: 1" << endl
+    << "  --query           print result served by the daemon" << endl
+    << "  --watch           print every result change pushed by the daemon" << endl
+    << "  --socket path     daemon socket, default: " << DetectionDaemon::get_default_socket_path() << endl
+    << "  --decode-benchmark  measure time and allocations of decoding a response" << endl
+    << "  --packets number  packets decoded by --decode-benchmark, default: 1000000" << endl
+    << "  --corpus path     decode responses from an exchange log instead of a typical one" << endl
+    << "  --record path     log every sent and received datagram to an exchange log" << endl
+    << "  --replay path     replay detections from an exchange log without network I/O" << endl;
+}
+
 int main(int argc, char* argv[])
 {
-  if (argc != 3)
+  Mode mode = Mode::Detect;
+  bool is_bind_to_device = false;
+  bool is_cache_used = false;
+  bool is_tcp_fallback_used = false;
+  string cache_path = ResultCache::get_default_path();
+  string socket_path = DetectionDaemon::get_default_socket_path();
+  size_t refresh_interval = 300;
+  size_t probe_interval = 30;
+  size_t sockets_number = 0;
+  size_t packets_number = 1000000;
+  double min_lifetime = 1;
+  double max_lifetime = 600;
+  double resolution = 1;
+  string record_path;
+  string replay_path;
+  string corpus_path;
+  vector<string> servers;
+  bool is_valid = true;
+
+  auto set_mode = [&mode, &is_valid](Mode new_mode)
+  {
+    is_valid = is_valid && Mode::Detect == mode;
+    mode = new_mode;
+  };
+
+  for (int i = 1; i < argc; ++i)
+  {
+    string argument = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if ("--all-interfaces" == argument)
+      set_mode(Mode::AllInterfaces);
+    else if ("--daemon" == argument)
+      set_mode(Mode::Daemon);
+    else if ("--monitor" == argument)
+      set_mode(Mode::Monitor);
+    else if ("--behavior" == argument)
+      set_mode(Mode::Behavior);
+    else if ("--port-sampling" == argument)
+      set_mode(Mode::PortSampling);
+    else if ("--keepalive" == argument)
+      set_mode(Mode::Keepalive);
+    else if ("--lifetime" == argument)
+      set_mode(Mode::Lifetime);
+    else if ("--decode-benchmark" == argument)
+      set_mode(Mode::DecodeBenchmark);
+    else if ("--query" == argument)
+      set_mode(Mode::Query);
+    else if ("--watch" == argument)
+      set_mode(Mode::Watch);
+    else if ("--bind-device" == argument)
+      is_bind_to_device = true;
+    else if ("--tcp-fallback" == argument)
+      is_tcp_fallback_used = true;
+    else if ("--cache" == argument)
+      is_cache_used = true;
+    else if ("--cache-file" == argument && has_value)
+    {
+      is_cache_used = true;
+      cache_path = argv[++i];
+    }
+    else if ("--refresh" == argument && has_value)
+      refresh_interval = strtoul(argv[++i], nullptr, 10);
+    else if ("--interval" == argument && has_value)
+      probe_interval = strtoul(argv[++i], nullptr, 10);
+    else if ("--sockets" == argument && has_value)
+      sockets_number = strtoul(argv[++i], nullptr, 10);
+    else if ("--packets" == argument && has_value)
+      packets_number = strtoul(argv[++i], nullptr, 10);
+    else if ("--min-lifetime" == argument && has_value)
+      min_lifetime = strtod(argv[++i], nullptr);
+    else if ("--max-lifetime" == argument && has_value)
+      max_lifetime = strtod(argv[++i], nullptr);
+    else if ("--resolution" == argument && has_value)
+      resolution = strtod(argv[++i], nullptr);
+    else if ("--record" == argument && has_value)
+      record_path = argv[++i];
+    else if ("--replay" == argument && has_value)
+    {
+      set_mode(Mode::Replay);
+      replay_path = argv[++i];
+    }
+    else if ("--corpus" == argument && has_value)
+      corpus_path = argv[++i];
+    else if ("--socket" == argument && has_value)
+      socket_path = argv[++i];
+    else if (0 == argument.compare(0, 2, "--"))
+      is_valid = false;
+    else
+      servers.push_back(argument);
+  }
+
+  size_t servers_number = 2;
+  if (Mode::Query == mode || Mode::Watch == mode || Mode::DecodeBenchmark == mode || Mode::Replay == mode)
+    servers_number = 0;
+  else if (Mode::Lifetime == mode || Mode::Behavior == mode || Mode::PortSampling == mode ||
+      Mode::Keepalive == mode)
+    servers_number = 1;
+
+  if (0 == sockets_number)
+  {
+    if (Mode::PortSampling == mode)
+      sockets_number = 64;
+    else if (Mode::Keepalive == mode)
+      sockets_number = 100;
+    else
+      sockets_number = 20;
+  }
+
+  // --sockets is shared by several modes, only --lifetime needs a pair of them.
+  // Resolution below a millisecond would be truncated to zero.
+  if (Mode::Lifetime == mode &&
+      (sockets_number < 2 || min_lifetime < 0 || max_lifetime <= min_lifetime || resolution < 0.001))
+    is_valid = false;
+
+  if (Mode::DecodeBenchmark == mode && 0 == packets_number)
+    is_valid = false;
+  if (Mode::DecodeBenchmark != mode && !corpus_path.empty())
+    is_valid = false;
+
+  // TCP fallback repeats test 1 of the blocking detection only.
+  if (Mode::Detect != mode && is_tcp_fallback_used)
+    is_valid = false;
+
+  // Only modes which talk to servers have exchanges to record.
+  if (0 == servers_number && !record_path.empty())
+    is_valid = false;
+
+  if (!is_valid || servers.size() != servers_number || 0 == refresh_interval || 0 == probe_interval ||
+      (is_bind_to_device && Mode::AllInterfaces != mode) ||
+      (is_cache_used && Mode::Detect != mode))
   {
-    cout << "Usage: " << argv[0] << " server1 server2" << endl;
+    print_usage(argv[0]);
 
     return 1;
   }
 
   try
   {
-    NatTypeDetector natTypeDetector;
-    natTypeDetector.execute(argv[1], argv[2]);
-    //natTypeDetector.execute("stun.ekiga.net", "stun.sipnet.ru");
-    natTypeDetector.print_result();
+    if (!record_path.empty())
+      ExchangeRecorder::instance().open(record_path);
+
+    switch (mode)
+    {
+      case Mode::Detect:
+      {
+        NatTypeDetector natTypeDetector;
+        StunTcpController tcpController;
+        if (is_tcp_fallback_used)
+          natTypeDetector.set_tcp_fallback(&tcpController);
+
+        if (is_cache_used)
+          natTypeDetector.execute(servers[0], servers[1], ResultCache(cache_path));
+        else
+          natTypeDetector.execute(servers[0], servers[1]);
+        //natTypeDetector.execute("stun.ekiga.net", "stun.sipnet.ru");
+        natTypeDetector.print_result();
+        break;
+      }
+
+      case Mode::AllInterfaces:
+      {
+        MultiInterfaceDetector multiInterfaceDetector(is_bind_to_device);
+        multiInterfaceDetector.execute(servers[0], servers[1]);
+        break;
+      }
+
+      case Mode::Daemon:
+      {
+        DetectionDaemon daemon(socket_path, refresh_interval);
+        daemon.execute(servers[0], servers[1]);
+        break;
+      }
+
+      case Mode::Monitor:
+      {
+        NatMonitor monitor(probe_interval);
+        monitor.execute(servers[0], servers[1]);
+        break;
+      }
+
+      case Mode::Lifetime:
+      {
+        auto to_duration = [](double seconds) { return BindingLifetimeProbe::Duration(size_t(seconds * 1000)); };
+        BindingLifetimeProbe probe(sockets_number, to_duration(min_lifetime), to_duration(max_lifetime),
+            to_duration(resolution));
+        probe.execute(servers[0]);
+        probe.print_result();
+        break;
+      }
+
+      case Mode::Behavior:
+      {
+        BehaviorDiscovery discovery;
+        discovery.execute(servers[0]);
+        discovery.print_result();
+        break;
+      }
+
+      case Mode::PortSampling:
+      {
+        PortAllocationSampler sampler(sockets_number);
+        sampler.execute(servers[0]);
+        sampler.print_result();
+        break;
+      }
+
+      case Mode::Keepalive:
+      {
+        vector<unique_ptr<StunController>> controllers;
+        KeepaliveScheduler scheduler;
+        scheduler.set_change_handler([](KeepaliveScheduler::BindingId binding, const string& previous,
+              const string& current)
+            {
+              time_t now = time(nullptr);
+              cout << "[" << put_time(localtime(&now), "%F %T") << "] Binding " << binding << ": "
+                << (previous.empty() ? "new" : previous) << " -> " << (current.empty() ? "lost" : current) << endl;
+            });
+
+        for (size_t i = 0; i < sockets_number; ++i)
+        {
+          controllers.push_back(make_unique<StunController>());
+          size_t socket_index = scheduler.add_socket(*controllers.back());
+          scheduler.add_binding(socket_index, servers[0], DEFAULT_PORT, chrono::seconds(probe_interval));
+        }
+
+        scheduler.run();
+        break;
+      }
+
+      case Mode::DecodeBenchmark:
+      {
+        DecodeBenchmark benchmark(packets_number);
+        if (!corpus_path.empty())
+        {
+          for (auto& packet : ExchangeReplay(corpus_path).get_received_packets())
+            benchmark.add_packet(packet);
+        }
+        benchmark.execute();
+        benchmark.print_result();
+        break;
+      }
+
+      case Mode::Replay:
+      {
+        ExchangeReplay replay(replay_path);
+        replay.execute();
+        break;
+      }
+
+      case Mode::Query:
+      {
+        NatDetectionResult result;
+        if (!DetectionDaemon::query(socket_path, result))
+          throw Exception("Daemon has no detection result yet.");
+
+        cout << "Result at: " << put_time(localtime(&result.timestamp), "%F %T") << endl;
+        print_result(result);
+        break;
+      }
+
+      case Mode::Watch:
+        DetectionDaemon::watch(socket_path);
+        break;
+    }
   }
   catch (const Exception& exception)
   {